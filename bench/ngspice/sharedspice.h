@@ -0,0 +1,90 @@
+#ifndef _NGSPICE_STUB_SHAREDSPICE_H
+#define _NGSPICE_STUB_SHAREDSPICE_H
+
+// Subset of ngspice's sharedspice.h used by spicetools, so that the benchmarks
+// build without ngspice installed. Implemented by ngspicestub.cpp.
+
+#include <stdbool.h>
+
+#define NG_BOOL bool
+
+typedef struct ngcomplex
+{
+    double cx_real;
+    double cx_imag;
+} ngcomplex_t;
+
+typedef struct vector_info
+{
+    char *v_name;
+    int v_type;
+    short v_flags;
+    double *v_realdata;
+    ngcomplex_t *v_compdata;
+    int v_length;
+} vector_info, *pvector_info;
+
+typedef struct vecvalues
+{
+    char *name;
+    double creal;
+    double cimag;
+    NG_BOOL is_scale;
+    NG_BOOL is_complex;
+} vecvalues, *pvecvalues;
+
+typedef struct vecvaluesall
+{
+    int veccount;
+    int vecindex;
+    pvecvalues *vecsa;
+} vecvaluesall, *pvecvaluesall;
+
+typedef struct vecinfo
+{
+    int number;
+    char *vecname;
+    NG_BOOL is_real;
+    void *pdvec;
+    void *pdvecscale;
+} vecinfo, *pvecinfo;
+
+typedef struct vecinfoall
+{
+    char *name;
+    char *title;
+    char *date;
+    char *type;
+    int veccount;
+    pvecinfo *vecs;
+} vecinfoall, *pvecinfoall;
+
+typedef int (SendChar)(char*, int, void*);
+typedef int (SendStat)(char*, int, void*);
+typedef int (ControlledExit)(int, NG_BOOL, NG_BOOL, int, void*);
+typedef int (SendData)(pvecvaluesall, int, int, void*);
+typedef int (SendInitData)(pvecinfoall, int, void*);
+typedef int (BGThreadRunning)(NG_BOOL, int, void*);
+typedef int (GetVSRCData)(double*, double, char*, int, void*);
+typedef int (GetISRCData)(double*, double, char*, int, void*);
+typedef int (GetSyncData)(double, double*, double, int, int, int, void*);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int ngSpice_Init(SendChar*, SendStat*, ControlledExit*, SendData*, SendInitData*, BGThreadRunning*, void*);
+int ngSpice_Init_Sync(GetVSRCData*, GetISRCData*, GetSyncData*, int*, void*);
+int ngSpice_Command(char*);
+pvector_info ngGet_Vec_Info(char*);
+char* ngSpice_CurPlot(void);
+char** ngSpice_AllPlots(void);
+char** ngSpice_AllVecs(char*);
+NG_BOOL ngSpice_running(void);
+NG_BOOL ngSpice_SetBkpt(double);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
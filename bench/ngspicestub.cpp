@@ -0,0 +1,150 @@
+// Stub of ngspice's shared library for benchmarking spicetools without ngspice.
+// It understands just enough of the circbyline commands sent by SpiceIf (.save
+// and external voltage sources) to call back into the library the way ngspice
+// does on run, tran, bg_run and bg_tran.
+
+#include <ngspice/sharedspice.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include "ngspicestub.h"
+
+using namespace std;
+
+static SendChar *s_sendchar;
+static SendStat *s_sendstat;
+static ControlledExit *s_exit;
+static SendData *s_senddata;
+static SendInitData *s_sendinitdata;
+static BGThreadRunning *s_bgrunning;
+static void *s_userdata;
+static GetVSRCData *s_vsrcdata;
+static void *s_syncuserdata;
+static vector<string> s_saves;
+static vector<string> s_sources;
+static atomic<bool> s_running {false};
+static int s_nsteps = 1000;
+static int s_nextra = 0;
+static int s_srciters = 2;
+
+extern "C" void ngstub_config(int nsteps, int nextra, int srciters)
+{
+    s_nsteps = nsteps;
+    s_nextra = nextra;
+    s_srciters = srciters;
+}
+
+static void simulate()
+{
+    vector<string> names { "time" };
+    for(auto& s:s_saves) names.push_back(s);
+    for(int i=0; i<s_nextra; i++) names.push_back( "stub" + to_string(i) );
+    int n = names.size();
+
+    vector<vecinfo> infos(n);
+    vector<pvecinfo> pinfos(n);
+    for(int i=0; i<n; i++)
+    {
+        infos[i] = { i, (char*) names[i].c_str(), true, NULL, NULL };
+        pinfos[i] = &infos[i];
+    }
+    vecinfoall initdata { (char*) "transient", (char*) "stub", (char*) "", (char*) "tran1", n, pinfos.data() };
+    s_sendinitdata(&initdata, 0, s_userdata);
+
+    vector<vecvalues> vals(n);
+    vector<pvecvalues> pvals(n);
+    for(int i=0; i<n; i++)
+    {
+        vals[i] = { (char*) names[i].c_str(), 0, 0, i == 0, false };
+        pvals[i] = &vals[i];
+    }
+    for(int step=0; step<s_nsteps; step++)
+    {
+        double time = step * 1e-12;
+        for(int it=0; it<s_srciters and s_vsrcdata; it++)
+            for(auto& src:s_sources)
+            {
+                double v;
+                s_vsrcdata(&v, time, (char*) src.c_str(), 0, s_syncuserdata);
+            }
+        vals[0].creal = time;
+        // net i toggles every i steps
+        for(int i=1; i<n; i++) vals[i].creal = ( step / i ) & 1 ? 1.8 : 0;
+        vecvaluesall data { n, step, pvals.data() };
+        s_senddata(&data, n, 0, s_userdata);
+    }
+}
+
+extern "C" int ngSpice_Init(SendChar *sendchar, SendStat *sendstat, ControlledExit *ngexit,
+    SendData *senddata, SendInitData *sendinitdata, BGThreadRunning *bgrunning, void *userdata)
+{
+    s_sendchar = sendchar;
+    s_sendstat = sendstat;
+    s_exit = ngexit;
+    s_senddata = senddata;
+    s_sendinitdata = sendinitdata;
+    s_bgrunning = bgrunning;
+    s_userdata = userdata;
+    // a new SpiceIf starts a new circuit
+    s_saves.clear();
+    s_sources.clear();
+    return 0;
+}
+
+extern "C" int ngSpice_Init_Sync(GetVSRCData *vsrcdata, GetISRCData*, GetSyncData*, int*, void *userdata)
+{
+    s_vsrcdata = vsrcdata;
+    s_syncuserdata = userdata;
+    return 0;
+}
+
+extern "C" int ngSpice_Command(char *command)
+{
+    string cmd(command);
+    if ( cmd.compare(0, 11, "circbyline ") == 0 )
+    {
+        istringstream is( cmd.substr(11) );
+        vector<string> tokens;
+        string tok;
+        while ( is >> tok ) tokens.push_back(tok);
+        if ( tokens.size() == 2 and tokens[0] == ".save" )
+            s_saves.push_back( tokens[1] );
+        else if ( tokens.size() >= 5 and toupper( tokens[0][0] ) == 'V' and tokens.back() == "external" )
+            s_sources.push_back( tokens[0] );
+    }
+    else if ( cmd == "run" or cmd.compare(0, 5, "tran ") == 0 ) simulate();
+    else if ( cmd == "bg_run" or cmd.compare(0, 8, "bg_tran ") == 0 )
+    {
+        s_running = true;
+        thread( []()
+        {
+            s_bgrunning(false, 0, s_userdata);
+            simulate();
+            s_running = false;
+            s_bgrunning(true, 0, s_userdata);
+        } ).detach();
+    }
+    return 0;
+}
+
+extern "C" pvector_info ngGet_Vec_Info(char*) { return NULL; }
+
+extern "C" char* ngSpice_CurPlot(void) { return (char*) "tran1"; }
+
+extern "C" char** ngSpice_AllPlots(void)
+{
+    static char *plots[] = { (char*) "tran1", NULL };
+    return plots;
+}
+
+extern "C" char** ngSpice_AllVecs(char*)
+{
+    static char *vecs[] = { NULL };
+    return vecs;
+}
+
+extern "C" NG_BOOL ngSpice_running(void) { return s_running; }
+
+extern "C" NG_BOOL ngSpice_SetBkpt(double) { return true; }
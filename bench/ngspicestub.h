@@ -0,0 +1,10 @@
+#ifndef _NGSPICESTUB_H
+#define _NGSPICESTUB_H
+
+// Controls for the stub ngspice in ngspicestub.cpp. A run synthesizes nsteps
+// steps over the vectors time, every .save'd net and nextra more nets. Each step
+// asks every external source for its value srciters times, like solver
+// iterations would, before sending the step's data.
+extern "C" void ngstub_config(int nsteps, int nextra, int srciters);
+
+#endif
@@ -0,0 +1,167 @@
+// Microbenchmarks of spicetools' hot paths against the stub ngspice in
+// ngspicestub.cpp. Prints time and heap allocations per step (or per operation).
+// Usage: spicebench [scale], scale multiplies the step counts (default 1).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <fstream>
+#include "spiceif.h"
+#include "spicedbg.h"
+#include "ngspicestub.h"
+
+using namespace std;
+
+static atomic<unsigned long> allocs {0};
+
+// Not inlined, or gcc pairs the malloc and free inside them with the new and
+// delete expressions and warns of a mismatch
+__attribute__((noinline)) void* operator new(size_t n)
+{
+    allocs.fetch_add(1, memory_order_relaxed);
+    auto p = malloc(n);
+    if ( p == NULL ) throw bad_alloc();
+    return p;
+}
+void* operator new[](size_t n) { return operator new(n); }
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+void operator delete[](void *p) noexcept { operator delete(p); }
+void operator delete[](void *p, size_t) noexcept { operator delete(p); }
+
+static int scale = 1;
+
+// Runs fn, which performs n units of work, and prints the cost per unit
+static void measure(string name, string unit, long n, function<void()> fn)
+{
+    auto a0 = allocs.load();
+    auto t0 = chrono::steady_clock::now();
+    fn();
+    auto t1 = chrono::steady_clock::now();
+    auto a1 = allocs.load();
+    double ns = chrono::duration<double,nano>(t1 - t0).count();
+    printf( "%-40s %12.1f ns/%-5s %10.3f allocs/%s\n", name.c_str(), ns / n, unit.c_str(),
+        double(a1 - a0) / n, unit.c_str() );
+    fflush(stdout);
+}
+
+// 62 32-bit output buses and 16 scalars make about 2000 watched nets
+static void outputNets(SpiceIf& s, list<Net*>& ports)
+{
+    for(int i=0; i<62; i++) ports.push_back( s.getNet<32>( "bus" + to_string(i) + "_", OUT ) );
+    for(int i=0; i<16; i++) ports.push_back( s.getNet<0>( "sig" + to_string(i), OUT ) );
+}
+
+static void benchSendData(string name, bool texttrace, bool bg)
+{
+    int steps = 20000 * scale;
+    ngstub_config(steps, 0, 0);
+    SpiceIf s((char*) "stub.spice", false);
+    list<Net*> ports;
+    outputNets(s, ports);
+    s.instantiate("top", ports);
+    NullTraceSink nullsink;
+    TraceWriter writer("/dev/null");
+    TextTraceSink textsink(writer);
+    s.setTraceSink( texttrace ? (TraceSink*) &textsink : &nullsink );
+    s.traceTimesteps(texttrace);
+    measure( name, "step", steps, [&]() { if ( bg ) s.runBg(); else s.run(); } );
+}
+
+static void benchVsrc()
+{
+    int steps = 5000 * scale, iters = 4, nbus = 8;
+    ngstub_config(steps, 0, iters);
+    SpiceIf s((char*) "stub.spice", false);
+    list<Net*> ports;
+    for(int i=0; i<nbus; i++) ports.push_back( s.getNet<32>( "in" + to_string(i) + "_", IN ) );
+    s.instantiate("top", ports);
+    NullTraceSink nullsink;
+    s.setTraceSink(&nullsink);
+    s.traceTimesteps(false);
+    measure( "SpiceIf::fnGetVSRCData (incl. steps)", "call", long(steps) * iters * nbus * 32,
+        [&]() { s.run(); } );
+    printf( "%-40s %lu hits %lu misses\n", "  vsrc cache", s.vsrcHits(), s.vsrcMisses() );
+}
+
+static void benchHex()
+{
+    long n = 200000 * scale;
+    ngstub_config(0, 0, 0);
+    SpiceIf s((char*) "stub.spice", false);
+    auto net = (VectorNet<512>*) s.getNet<512>("wide", IN);
+    string hex = "x" + string(128, 'a');
+    measure( "VectorNet<512>::set(hex)", "op", n, [&]() { for(long i=0; i<n; i++) net->set(hex); } );
+    uint64_t words[8];
+    for(int i=0; i<8; i++) words[i] = 0x0123456789abcdefULL * ( i + 1 );
+    measure( "VectorNet<512>::setWords", "op", n, [&]() { for(long i=0; i<n; i++) net->setWords(words); } );
+    ostringstream os;
+    measure( "VectorNet<512>::print", "op", n,
+        [&]() { for(long i=0; i<n; i++) { os.str(""); net->print(os); } } );
+    bitset<512> bits;
+    for(int i=0; i<512; i+=3) bits[i] = 1;
+    HexUtils hu;
+    size_t total = 0;
+    measure( "HexUtils::bitset2hexstr<512>", "op", n,
+        [&]() { for(long i=0; i<n; i++) total += hu.bitset2hexstr<512>(bits).size(); } );
+    if ( total == 0 ) printf("unexpected\n");
+}
+
+// Binary raw file with time and nnets nets, net i toggling every i+1 steps with a
+// few steps in the dangling band after each edge
+static string writeRaw(int nnets, int steps)
+{
+    string flnm = "/tmp/spicebench.raw";
+    auto fp = fopen( flnm.c_str(), "wb" );
+    fprintf( fp, "Title: spicebench\nPlotname: Transient Analysis\nFlags: real\n"
+        "No. Variables: %d\nNo. Points: %d\nVariables:\n\t0\ttime\ttime\n", nnets + 1, steps );
+    for(int i=0; i<nnets; i++) fprintf( fp, "\t%d\tv(n%d)\tvoltage\n", i + 1, i );
+    fprintf( fp, "Binary:\n" );
+    vector<double> row( nnets + 1 );
+    for(int step=0; step<steps; step++)
+    {
+        row[0] = step * 1e-12;
+        for(int i=0; i<nnets; i++)
+            row[i+1] = step % ( i + 1 ) < 2 ? 0.9 : ( step / ( i + 1 ) ) & 1 ? 1.8 : 0;
+        fwrite( row.data(), sizeof(double), row.size(), fp );
+    }
+    fclose(fp);
+    return flnm;
+}
+
+static void benchPlay()
+{
+    int nnets = 128, steps = 50000 * scale;
+    auto flnm = writeRaw(nnets, steps);
+    ofstream null("/dev/null");
+    auto coutbuf = cout.rdbuf( null.rdbuf() );
+    {
+        SpiceDbg d(flnm);
+        for(int i=0; i<nnets; i+=32) d.addWatch<32>( "w" + to_string(i), "n", i, "" );
+        measure( "SpiceDbg::play", "step", steps, [&]() { d.play(); } );
+        measure( "SpiceDbg::play(all cores)", "step", steps, [&]() { d.play(0); } );
+        measure( "SpiceDbg::digitize", "step", steps, [&]() { d.digitize(); } );
+        measure( "SpiceDbg::play digitized", "step", steps, [&]() { d.play(); } );
+        d.addUWatches(0.5, 1.3, 2);
+        measure( "SpiceDbg::play with UWatches", "step", steps, [&]() { d.play(); } );
+        d.digitize();
+        measure( "SpiceDbg::play with UWatches digitized", "step", steps, [&]() { d.play(); } );
+    }
+    cout.rdbuf(coutbuf);
+    remove( flnm.c_str() );
+}
+
+int main(int argc, char *argv[])
+{
+    if ( argc > 1 ) scale = max( 1, atoi(argv[1]) );
+    benchSendData("SpiceIf::fnSendData (null trace)", false, false);
+    benchSendData("SpiceIf::fnSendData (text trace)", true, false);
+    benchSendData("SpiceIf::runBg (null trace)", false, true);
+    benchVsrc();
+    benchHex();
+    benchPlay();
+    return 0;
+}
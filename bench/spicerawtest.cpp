@@ -0,0 +1,132 @@
+// Checks that RawFile reads chunked raw files cut short at any byte, or with a
+// damaged index, as the complete chunks they hold, without reading past the end.
+// Usage: spicerawtest (exits 1 on the first failure)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "spiceraw.h"
+
+using namespace std;
+
+static const char *flnm = "spicerawtest.raw";
+static const int nvars = 3;
+
+static void fail(string msg)
+{
+    cout << "spicerawtest: " << msg << endl;
+    unlink(flnm);
+    exit(1);
+}
+
+static double value(size_t row, int var) { return row * ( var + 1 ) + 0.5; }
+
+static string readAll()
+{
+    FILE *fp = fopen( flnm, "rb" );
+    if ( fp == NULL ) fail( string("could not read ") + flnm );
+    string data;
+    char buf[4096];
+    size_t n;
+    while ( ( n = fread( buf, 1, sizeof(buf), fp ) ) > 0 ) data.append(buf, n);
+    fclose(fp);
+    return data;
+}
+
+static void writeAll(const string& data)
+{
+    FILE *fp = fopen( flnm, "wb" );
+    if ( fp == NULL or fwrite( data.data(), 1, data.size(), fp ) != data.size() )
+        fail( string("could not write ") + flnm );
+    fclose(fp);
+}
+
+template <typename T> static void put(string& s, T val) { s.append( (char*) &val, sizeof(T) ); }
+
+// Reads the file and checks that it holds rows 0..n-1, n being between minpoints and maxpoints
+static size_t check(string what, size_t minpoints, size_t maxpoints)
+{
+    RawFile raw(flnm);
+    auto n = raw.points();
+    if ( n < minpoints or n > maxpoints )
+        fail( what + ": " + to_string(n) + " points, expected " + to_string(minpoints) + ".." + to_string(maxpoints) );
+    for(int v=0; v<nvars; v++)
+    {
+        auto c = raw.column(v);
+        if ( c.length() != n ) fail( what + ": column length differs from points" );
+        for(size_t i=0; i<n; i++)
+            if ( c[i] != value(i, v) ) fail( what + ": wrong value at row " + to_string(i) );
+    }
+    return n;
+}
+
+int main()
+{
+    const size_t rows = 100, chunkpoints = 7;
+    {
+        RawStreamWriter w(flnm, chunkpoints, 3);
+        w.begin( { "time", "v(a)", "v(b)" } );
+        for(size_t i=0; i<rows; i++)
+        {
+            double row[nvars];
+            for(int v=0; v<nvars; v++) row[v] = value(i, v);
+            w.append(row);
+        }
+        w.close();
+    }
+    auto full = readAll();
+    check("complete file", rows, rows);
+
+    // Cut at every byte after the header: the rows of the complete chunks before the cut
+    size_t hdr = 12 + 4 + 4 + 4 + 4 + 4 + 4;
+    size_t last = 0;
+    for(size_t len=hdr; len<full.size(); len++)
+    {
+        writeAll( full.substr(0, len) );
+        auto n = check( "cut at " + to_string(len), last, rows );
+        if ( n % chunkpoints and n != rows ) fail( "cut at " + to_string(len) + ": partial chunk read" );
+        last = n;
+    }
+    printf( "truncated files ok (%zu cuts)\n", full.size() - hdr );
+
+    // Index claiming more chunks than fit in the file, and index pointing past the end
+    auto bad = full;
+    uint64_t idxpos;
+    memcpy( &idxpos, &bad[ bad.size() - 16 ], 8 );
+    uint64_t huge = ~uint64_t(0) / 2;
+    memcpy( &bad[ idxpos + 8 ], &huge, 8 );
+    writeAll(bad);
+    check("index with too many chunks", rows, rows);
+    bad = full;
+    memcpy( &bad[ idxpos + 16 ], &huge, 8 );
+    writeAll(bad);
+    check("index pointing past the end", rows, rows);
+    bad = full;
+    memcpy( &bad[ bad.size() - 16 ], &huge, 8 );
+    writeAll(bad);
+    check("index offset past the end", rows, rows);
+    printf( "damaged indexes ok\n" );
+
+    // Chunks of unequal length, found by search instead of division
+    string s = "SPRAWHDR";
+    put<uint32_t>(s, nvars);
+    for(string n : { "time", "v(a)", "v(b)" })
+    {
+        put<uint32_t>(s, n.size());
+        s += n;
+    }
+    size_t row = 0;
+    for(size_t npoints : { 3, 5, 1, 8 })
+    {
+        s += "SPRAWCHK";
+        put<uint64_t>(s, npoints);
+        for(size_t i=0; i<npoints; i++, row++)
+            for(int v=0; v<nvars; v++) put<double>( s, value(row, v) );
+    }
+    writeAll(s);
+    check("unequal chunks", row, row);
+    printf( "unequal chunks ok\n" );
+    unlink(flnm);
+    return 0;
+}
@@ -5,9 +5,27 @@
 
 using namespace std;
 
-const string rawopfile = "simuop.raw";
-const double vdd = 1.8;
-const string vddstr = to_string(vdd);
-const double logicthresh = 0.81; // Can be .45 to .55 of Vdd
+// Defaults. A process may change them before creating a SpiceIf or SpiceDbg,
+// preferably through SpiceConf::apply which keeps vddstr in line with vdd.
+inline string rawopfile = "simuop.raw";
+inline double vdd = 1.8;
+inline string vddstr = to_string(vdd);
+inline double logicthresh = 0.81; // Can be .45 to .55 of Vdd
+
+// Per instance configuration, e.g. for a SpiceFarm job
+class SpiceConf
+{
+public:
+    string rawopfile = ::rawopfile;
+    double vdd = ::vdd;
+    double logicthresh = ::logicthresh;
+    void apply()
+    {
+        ::rawopfile = rawopfile;
+        ::vdd = vdd;
+        ::vddstr = to_string(vdd);
+        ::logicthresh = logicthresh;
+    }
+};
 
 #endif
@@ -0,0 +1,94 @@
+#ifndef _SPICECORO_H
+#define _SPICECORO_H
+
+// Needs C++20 (coroutines)
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include "spiceif.h"
+
+using namespace std;
+
+// A testbench process written as a coroutine, e.g.
+//     SimTask driver(Net *clk, Net *d)
+//     {
+//         co_await until(1e-9);
+//         for(int i=0; ; i++)
+//         {
+//             co_await rising(clk);
+//             d->set(i & 1);
+//         }
+//     }
+//     auto t = driver(clk, d);
+//     t.start(spiceif);
+//     spiceif.run();
+// A waiting task is one entry in SpiceIf's scheduler, among the subscriptions of
+// the net's slots or in the timer queue, so it costs nothing on the steps where
+// its condition is not met. Tasks run on the thread that runs the scheduler, one
+// at a time, like event handlers. The SimTask object owns the coroutine and must
+// outlive the runs it takes part in.
+class SimTask
+{
+public:
+    struct promise_type
+    {
+        SpiceIf *spiceif = NULL;
+        // cleared when the task is destroyed, so that pending waits don't resume it
+        shared_ptr<bool> alive = make_shared<bool>(true);
+        SimTask get_return_object() { return SimTask( coroutine_handle<promise_type>::from_promise(*this) ); }
+        suspend_always initial_suspend() { return {}; }
+        suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+private:
+    coroutine_handle<promise_type> _h;
+public:
+    // Runs the task up to its first wait
+    void start(SpiceIf& spiceif)
+    {
+        _h.promise().spiceif = &spiceif;
+        _h.resume();
+    }
+    bool done() { return _h and _h.done(); }
+    explicit SimTask(coroutine_handle<promise_type> h) : _h(h) {}
+    SimTask(SimTask&& other) : _h(other._h) { other._h = nullptr; }
+    SimTask(const SimTask&) = delete;
+    ~SimTask()
+    {
+        if ( not _h ) return;
+        *_h.promise().alive = false;
+        _h.destroy();
+    }
+};
+
+// What the co_awaits below return. The task is resumed from a once subscription
+// or a timer, which report an input change if the task made one.
+class SimWait
+{
+    Net *_net;
+    t_edge _edge;
+    double _t;  // for a net of NULL
+public:
+    bool await_ready() { return false; }
+    void await_suspend(coroutine_handle<SimTask::promise_type> h)
+    {
+        auto s = h.promise().spiceif;
+        auto alive = h.promise().alive;
+        t_action fn = [s, h, alive]() { return *alive and s->changesInputs( [h]() { h.resume(); } ); };
+        if ( _net ) s->once(_net, _edge, fn);
+        else s->at(_t, fn);
+    }
+    void await_resume() {}
+    SimWait(Net *net, t_edge edge, double t = 0) : _net(net), _edge(edge), _t(t) {}
+};
+
+// Next rising or falling edge of a scalar net, next change of any net
+inline SimWait rising(Net *net) { return SimWait(net, RISING); }
+inline SimWait falling(Net *net) { return SimWait(net, FALLING); }
+inline SimWait change(Net *net) { return SimWait(net, CHANGE); }
+// First step at or after simulation time t
+inline SimWait until(double t) { return SimWait(NULL, CHANGE, t); }
+
+#endif
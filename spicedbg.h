@@ -5,66 +5,225 @@
 #include <list>
 #include <vector>
 #include <bitset>
+#include <string>
+#include <sstream>
+#include <thread>
 #include <string.h>
-#include <ngspice/sharedspice.h>
-#include "spiceif.h"
+#include "spiceconf.h"
+#include "spicehex.h"
+#include "spiceraw.h"
+#include "spiceidx.h"
+#include "spicevcd.h"
+#include "spicemeas.h"
+#ifdef SPICEPERF
+#include "spiceperf.h"
+#endif
 
 using namespace std;
 
+// Nets of a raw file digitized once, for repeated playback. Row i holds the logic
+// values of all nets at step i, 1 bit each, so that a watch reads its value as
+// words and an unchanged step is one row compare. For nets watched for dangling
+// values only the runs of steps inside the (l,h) band are kept, as [begin,end).
+class DigitalCache
+{
+    RawFile& _raw;
+    vector<int> _cols;              // raw column per bit
+    int _nwords = 0;
+    size_t _steps = 0;
+    vector<uint64_t> _rows;
+    typedef struct { int begin; int end; } t_run;
+    vector<int> _bandcols;
+    vector<vector<t_run>> _bandruns; // per band net
+    void digitizeRows(size_t from, size_t to)
+    {
+        vector<RawColumn> cols;
+        for(auto c:_cols) cols.push_back( _raw.column(c) );
+        auto nbits = cols.size();
+        for(size_t i=from; i<to; i++)
+        {
+            auto row = &_rows[ i * _nwords ];
+            for(size_t b=0; b<nbits; b++)
+                row[ b >> 6 ] |= uint64_t( cols[b][i] > logicthresh ) << ( b & 63 );
+        }
+    }
+    void bandRuns(size_t from, size_t to, double l, double h, vector<vector<t_run>>& runs)
+    {
+        runs.assign( _bandcols.size(), {} );
+        for(size_t k=0; k<_bandcols.size(); k++)
+        {
+            auto col = _raw.column( _bandcols[k] );
+            for(size_t i=from; i<to; i++)
+            {
+                auto v = col[i];
+                if ( not ( v > l and v < h ) ) continue;
+                if ( not runs[k].empty() and runs[k].back().end == (int) i ) runs[k].back().end++;
+                else runs[k].push_back( { (int) i, (int) i + 1 } );
+            }
+        }
+    }
+public:
+    // Bit of the first of the nets, which get consecutive bits. To be called before build.
+    int add(const vector<int>& cols)
+    {
+        int bit = _cols.size();
+        _cols.insert( _cols.end(), cols.begin(), cols.end() );
+        return bit;
+    }
+    // Index of the net among the band nets. To be called before build.
+    int addBand(int col)
+    {
+        _bandcols.push_back(col);
+        return _bandcols.size() - 1;
+    }
+    // One pass over the samples, split over nthreads
+    void build(double l, double h, int nthreads)
+    {
+        _steps = _raw.points();
+        _nwords = ( _cols.size() + 63 ) / 64;
+        _rows.assign( _steps * _nwords, 0 );
+        vector<vector<vector<t_run>>> runs(nthreads);
+        vector<thread> threads;
+        auto per = ( _steps + nthreads - 1 ) / nthreads;
+        for(int t=0; t<nthreads; t++)
+            threads.emplace_back( [this,t,per,l,h,&runs]()
+            {
+                auto from = min( _steps, t * per );
+                auto to = min( _steps, from + per );
+                digitizeRows(from, to);
+                bandRuns(from, to, l, h, runs[t]);
+            } );
+        for(auto& th:threads) th.join();
+        // runs cut at a thread boundary are joined again
+        _bandruns.assign( _bandcols.size(), {} );
+        for(auto& truns:runs)
+            for(size_t k=0; k<_bandcols.size(); k++)
+                for(auto r:truns[k])
+                {
+                    auto& dest = _bandruns[k];
+                    if ( not dest.empty() and dest.back().end == r.begin ) dest.back().end = r.end;
+                    else dest.push_back(r);
+                }
+    }
+    // n <= 64 values of consecutive nets from bit at step, packed with bit at bit 0
+    uint64_t extract(int step, int bit, int n)
+    {
+        auto row = &_rows[ size_t(step) * _nwords ];
+        auto wi = bit >> 6;
+        auto off = bit & 63;
+        uint64_t val = row[wi] >> off;
+        if ( off and off + n > 64 ) val |= row[wi+1] << ( 64 - off );
+        return n == 64 ? val : val & ( ( uint64_t(1) << n ) - 1 );
+    }
+    bool sameAsPrev(int step)
+    {
+        auto row = &_rows[ size_t(step) * _nwords ];
+        return step > 0 and equal( row, row + _nwords, row - _nwords );
+    }
+    const vector<t_run>& bandRuns(int k) { return _bandruns[k]; }
+    size_t bytes() { return _rows.size() * sizeof(uint64_t); }
+    DigitalCache(RawFile& raw) : _raw(raw) {}
+};
+
 class Watch : public HexUtils
 {
 protected:
     const string _name;
-    bool logicVal(int i, double *v)
+    RawFile& _raw;
+    bool logicVal(int i, RawColumn& v)
     {
         return v[i] > logicthresh;
     }
-    // Note: ngGet_Vec_Info pointers are not guaranteed to retain values
-    pvector_info getvec(string name)
+    RawColumn getvec(string name)
     {
-        auto v = ngGet_Vec_Info((char*)name.c_str());
-        if ( v == NULL )
+        if ( not _raw.has(name) )
         {
             cout << "Could not get vector named: " << name << endl;
             exit(1);
         }
-        return v;
+        return _raw.column(name);
     }
 public:
-    virtual void report() = 0;
+    string name() { return _name; }
+    virtual void report(ostream& os) = 0;
     virtual bool nextState(int) = 0;
-    Watch(string name) : _name(name) {}
+    // Puts the watch in the state it would have after playing steps 0 to i-1
+    virtual void seek(int i) {}
+    virtual Watch* clone() = 0;
+    // For waveform export: width in bits and the current value MSB first
+    virtual int width() { return 1; }
+    virtual string bitstr() = 0;
+    // Registers the watch's nets with the cache, to be read from it once built
+    virtual void digitize(DigitalCache& cache) {}
+    Watch(string name, RawFile& raw) : _name(name), _raw(raw) {}
+    virtual ~Watch() {}
 };
 
 template<int sz> class VectorWatch : public Watch
 {
-    bitset<sz> _state;
-    vector<double*> _vecs;
+    WideWord<sz> _state;
+    vector<RawColumn> _vecs;
+    vector<int> _cols;
+    DigitalCache *_cache = NULL;
+    int _cachebit;
+    WideWord<sz> valueAt(int i)
+    {
+        WideWord<sz> val;
+        if ( _cache )
+            for(int wi = 0; wi < WideWord<sz>::nwords; wi++)
+                val.w[wi] = _cache->extract( i, _cachebit + wi * 64, min( 64, sz - wi * 64 ) );
+        else
+            for(int vi = 0; vi < sz; vi++)
+                val.w[ vi >> 6 ] |= uint64_t( logicVal(i,_vecs[vi]) ) << ( vi & 63 );
+        return val;
+    }
 public:
-    void report() { cout << _name << "=" << bitset2hexstr<sz>(_state) << " "; }
+    void report(ostream& os)
+    {
+        char hex[ ( sz + 3 ) / 4 ];
+        words2hexstr( _state.w, sz, hex );
+        os << _name << "=";
+        os.write( hex, sizeof(hex) ) << " ";
+    }
+    int width() { return sz; }
+    string bitstr() { return _state.binstr(); }
+    const WideWord<sz>& value() { return _state; }
+    void getWords(uint64_t *words) { copy( _state.w, _state.w + WideWord<sz>::nwords, words ); }
     bool nextState(int i)
     {
-        bool changed = false;
-        for(int vi = 0; vi < sz; vi++)
-        {
-            auto newval = logicVal(i,_vecs[vi]);
-            if ( i == 0 or newval != _state[vi] )
-                changed = true;
-            _state[vi] = newval;
-        }
+        auto newstate = valueAt(i);
+        bool changed = i == 0 or newstate != _state;
+        _state = newstate;
         return changed;
     }
-    VectorWatch(string name, list<string>& netnames) : Watch(name)
+    void seek(int i)
     {
-        for(auto n:netnames) _vecs.push_back( getvec(n)->v_realdata );
+        if ( i == 0 ) return; // step 0 always counts as a change
+        _state = valueAt(i-1);
+    }
+    Watch* clone() { return new VectorWatch<sz>(*this); }
+    void digitize(DigitalCache& cache)
+    {
+        _cachebit = cache.add(_cols);
+        _cache = &cache;
+    }
+    VectorWatch(string name, RawFile& raw, list<string>& netnames) : Watch(name, raw)
+    {
+        for(auto n:netnames)
+        {
+            _vecs.push_back( getvec(n) );
+            _cols.push_back( _raw.col(n) );
+        }
     }
 };
 
 class UWatch : public Watch
 {
-    double *_vec;
+    RawColumn _vec;
+    int _col;
     int _ustateCnt = 0;
     bool _inUState = false;
+    int _curi = 0;
     bool pointUState(int i)
     {
         auto v = _vec[i];
@@ -74,24 +233,53 @@ public:
     static inline double _l;
     static inline double _h;
     static inline int _nsteps;
-    void report() {}
+    RawColumn& column() { return _vec; }
+    DigitalCache *_cache = NULL;
+    int _band = -1;             // index among the cache's band nets
+    void digitize(DigitalCache& cache)
+    {
+        _band = cache.addBand(_col);
+        _cache = &cache;
+    }
+    void report(ostream& os) { reportAt(os, _curi, _inUState); }
+    void reportAt(ostream& os, int i, bool inUState)
+    {
+        os << _name
+            << " UState=" << inUState
+            << " val=" << _vec[i]
+            << " step=" << i
+            << "\n";
+    }
+    // Returns true when the net enters or leaves the dangling state
     bool nextState(int i)
     {
+        _curi = i;
+        if ( i == 0 ) // playback restarted
+        {
+            _ustateCnt = 0;
+            _inUState = false;
+        }
         _ustateCnt = pointUState(i) ? _ustateCnt + 1 : 0;
         bool newInUState = _ustateCnt >= _nsteps;
         bool changed = newInUState != _inUState;
         _inUState = newInUState;
-        if ( changed )
-            cout << _name
-                << " UState=" << _inUState
-                << " val=" << _vec[i]
-                << " step=" << i
-                << endl;
-        return false;
+        return changed;
     }
-    UWatch( string name ) : Watch( name )
+    // Only the run of dangling points right before i matters, and only up to _nsteps
+    void seek(int i)
     {
-        _vec = getvec(name)->v_realdata;
+        _ustateCnt = 0;
+        for(int j=i-1; j>=0 and _ustateCnt < _nsteps and pointUState(j); j--)
+            _ustateCnt++;
+        _inUState = _ustateCnt >= _nsteps;
+    }
+    Watch* clone() { return new UWatch(*this); }
+    // Dangling intervals show up as x
+    string bitstr() { return _inUState ? "x" : logicVal(_curi,_vec) ? "1" : "0"; }
+    UWatch( string name, RawFile& raw ) : Watch( name, raw )
+    {
+        _vec = getvec(name);
+        _col = _raw.col(name);
     }
 };
 
@@ -99,39 +287,247 @@ class TimeWatch : public Watch
 {
     int _curi = 0;
     int _steps;
-    double *_vec;
+    RawColumn _vec;
 public:
     int steps() { return _steps; }
-    void report() { printf("step=%d time=%e ",_curi,_vec[_curi]); }
+    double time(int i) { return _vec[i]; }
+    string bitstr() { return ""; }
+    void report(ostream& os)
+    {
+        char buf[64];
+        snprintf(buf,sizeof(buf),"step=%d time=%e ",_curi,_vec[_curi]);
+        os << buf;
+    }
+    Watch* clone() { return new TimeWatch(*this); }
     bool nextState(int i)
     {
         _curi = i;
         return false;
     }
-    TimeWatch() : Watch("time")
+    TimeWatch(RawFile& raw) : Watch("time", raw)
     {
-        auto ngvec = getvec(_name);
-        _vec = ngvec->v_realdata;
-        _steps = ngvec->v_length;
+        _vec = getvec(_name);
+        _steps = _vec.length();
     }
 };
 
-class SpiceDbg : public SpiceIfBase
+// Dangling detection for all UWatches at once, equivalent to calling their
+// nextState on every step. Per step the watched columns are gathered into a
+// contiguous array and the run counters of all nets are updated in a branchless
+// loop that the compiler turns into SIMD compares. Events come out sorted by
+// step and then by the order of the UWatches.
+class UScanner
 {
+    vector<UWatch*> _uwatches;
+    DigitalCache *_cache = NULL;    // if all nets are in it
+    vector<RawColumn> _cols;
+    vector<double> _vals;
+    vector<int64_t> _cnt;
+    vector<int64_t> _state;
+    vector<int64_t> _flip;
+public:
+    struct Event
+    {
+        int step;
+        int net;
+        bool inUState;
+    };
+    // Same as UWatch::seek, for all nets
+    void seek(int i)
+    {
+        for(size_t k=0; k<_cols.size(); k++)
+        {
+            int64_t cnt = 0;
+            for(int j=i-1; j>=0 and cnt < UWatch::_nsteps; j--, cnt++)
+            {
+                auto v = _cols[k][j];
+                if ( not ( v > UWatch::_l and v < UWatch::_h ) ) break;
+            }
+            _cnt[k] = cnt;
+            _state[k] = cnt >= UWatch::_nsteps;
+        }
+    }
+    // Events from the cached dangling runs: a run of at least nsteps steps enters
+    // the dangling state at its nsteps'th step and leaves it right after its end
+    void scanCached(int from, int to, vector<Event>& events)
+    {
+        auto start = events.size();
+        for(size_t k=0; k<_uwatches.size(); k++)
+        {
+            auto& runs = _cache->bandRuns( _uwatches[k]->_band );
+            auto it = lower_bound( runs.begin(), runs.end(), from,
+                [](const auto& r, int step) { return r.end < step; } );
+            for( ; it != runs.end() and it->begin + UWatch::_nsteps - 1 < to; it++ )
+            {
+                if ( it->end - it->begin < UWatch::_nsteps ) continue;
+                auto enter = it->begin + UWatch::_nsteps - 1;
+                if ( enter >= from ) events.push_back( { enter, (int) k, true } );
+                if ( it->end >= from and it->end < to ) events.push_back( { it->end, (int) k, false } );
+            }
+        }
+        sort( events.begin() + start, events.end(),
+            [](const Event& a, const Event& b) { return a.step < b.step or ( a.step == b.step and a.net < b.net ); } );
+    }
+    void scan(int from, int to, vector<Event>& events)
+    {
+        auto n = _cols.size();
+        if ( n == 0 ) return;
+        if ( _cache ) return scanCached(from, to, events);
+        const double l = UWatch::_l, h = UWatch::_h;
+        const int64_t nsteps = UWatch::_nsteps;
+        auto vals = _vals.data();
+        auto cnt = _cnt.data();
+        auto state = _state.data();
+        auto flip = _flip.data();
+        for(int i=from; i<to; i++)
+        {
+            for(size_t k=0; k<n; k++) vals[k] = _cols[k][i];
+            int64_t anyflip = 0;
+            for(size_t k=0; k<n; k++)
+            {
+                int64_t u = ( vals[k] > l ) & ( vals[k] < h );
+                cnt[k] = ( cnt[k] + 1 ) * u;
+                int64_t newstate = cnt[k] >= nsteps;
+                flip[k] = newstate ^ state[k];
+                state[k] = newstate;
+                anyflip |= flip[k];
+            }
+            if ( anyflip )
+                for(size_t k=0; k<n; k++)
+                    if ( flip[k] ) events.push_back( { i, (int) k, state[k] != 0 } );
+        }
+    }
+    void report(ostream& os, Event& e) { _uwatches[e.net]->reportAt(os, e.step, e.inUState); }
+    UScanner(list<UWatch*>& uwatches) :
+        _uwatches( uwatches.begin(), uwatches.end() ),
+        _vals( uwatches.size() ),
+        _cnt( uwatches.size() ),
+        _state( uwatches.size() ),
+        _flip( uwatches.size() )
+    {
+        for(auto u:_uwatches) _cols.push_back( u->column() );
+        if ( UWatch::_nsteps > 0 and not _uwatches.empty() and all_of( _uwatches.begin(), _uwatches.end(),
+            [](UWatch *u) { return u->_cache != NULL; } ) )
+            _cache = _uwatches[0]->_cache;
+    }
+};
+
+// Reads the raw file by itself (see spiceraw.h), ngspice is not needed for playback
+class SpiceDbg
+{
+    RawFile *_raw;
+    string _rawfile;
+    RawIndex *_idx = NULL;
+    DigitalCache *_cache = NULL;
+    size_t _cachedwatches = 0;  // watches when the cache was built
     TimeWatch *_timewatch;
+#ifdef SPICEPERF
+    SpicePerf _perf;
+#endif
     list<Watch*> _watches;
-    list<Watch*> _uwatches;
-    void report()
+    list<UWatch*> _uwatches;
+    list<Meas*> _meas;
+    // Plays steps [from,to) given the watches and scanner are in the state of step
+    // from-1. Dangling events are scanned a tile of steps ahead of the watches.
+    // With showfirst the watches are reported at step from even if unchanged.
+    // Measurements, if given, are fed every step.
+    static void playRange(int from, int to, Watch *timewatch,
+        list<Watch*>& watches, UScanner& uscanner, ostream& os, bool showfirst = false,
+        DigitalCache *cache = NULL, list<Meas*> *meas = NULL)
     {
-        _timewatch->report();
-        for( auto w:_watches ) w->report();
-        cout << endl;
+        const int tilesteps = 4096;
+        vector<UScanner::Event> events;
+        for(int tile=from; tile<to; tile+=tilesteps)
+        {
+            auto tileend = min( to, tile + tilesteps );
+            events.clear();
+            uscanner.scan(tile, tileend, events);
+            auto ev = events.begin();
+            for(int i=tile; i<tileend; i++)
+            {
+                bool changed = false;
+                // a step with the same digitized values as the previous one changes no watch
+                if ( cache == NULL or not cache->sameAsPrev(i) or ( showfirst and i == from ) )
+                    for(auto w:watches)
+                        if ( w->nextState(i) ) changed = true;
+                if ( changed or ( showfirst and i == from ) )
+                {
+                    timewatch->nextState(i);
+                    timewatch->report(os);
+                    for( auto w:watches ) w->report(os);
+                    os << "\n";
+                }
+                for( ; ev != events.end() and ev->step == i; ev++ )
+                    uscanner.report(os, *ev);
+                if ( meas )
+                    for(auto m:*meas) m->step(i);
+            }
+        }
+    }
+    // The cache, if all watches read from it
+    DigitalCache* rowCache() { return _cache and _cachedwatches == _watches.size() ? _cache : NULL; }
+    // One chunk of a parallel play, on private copies of the watches
+    void playChunk(int from, int to, string& out)
+    {
+        auto timewatch = _timewatch->clone();
+        list<Watch*> watches;
+        for( auto w:_watches ) watches.push_back( w->clone() );
+        for( auto w:watches ) w->seek(from);
+        UScanner uscanner(_uwatches);
+        uscanner.seek(from);
+        ostringstream os;
+        playRange(from, to, timewatch, watches, uscanner, os, false, rowCache());
+        out = os.str();
+        delete timewatch;
+        for( auto w:watches ) delete w;
     }
 public:
+    // Digitizes the nets of all watches added so far, 1 bit per net and step, and
+    // the dangling runs of the nets watched by addUWatches. Later plays and exports
+    // read from this instead of thresholding the raw samples again.
+    void digitize(int nthreads = 0)
+    {
+        if ( nthreads <= 0 ) nthreads = max( 1u, thread::hardware_concurrency() );
+        delete _cache;
+        _cache = new DigitalCache(*_raw);
+        for(auto w:_watches) w->digitize(*_cache);
+        for(auto u:_uwatches) u->digitize(*_cache);
+        _cache->build( UWatch::_l, UWatch::_h, nthreads );
+        _cachedwatches = _watches.size();
+    }
+    // Built on first use, or read from the sidecar file rawfile.idx if it is current
+    RawIndex& index()
+    {
+        if ( _idx == NULL ) _idx = new RawIndex(*_raw, _rawfile);
+        return *_idx;
+    }
+    // Logic value of a net at time t, i.e. at the last step at or before t
+    bool valueAt(string netname, double t)
+    {
+        return index().valueAtStep( netname, max( 0, index().stepBefore(t) ) );
+    }
+    // Time of the first change of a net after time t, -1 if there is none
+    double nextEdge(string netname, double t)
+    {
+        auto step = index().nextEdgeStep( netname, index().stepBefore(t) );
+        return step < 0 ? -1 : index().time(step);
+    }
+    // Same as play but only for the steps in [t0,t1], starting with the state at t0
+    void playWindow(double t0, double t1)
+    {
+        auto from = index().stepAt(t0);
+        auto to = index().stepBefore(t1) + 1;
+        if ( from >= to ) return;
+        for(auto w:_watches) w->seek(from);
+        UScanner uscanner(_uwatches);
+        uscanner.seek(from);
+        playRange(from, to, _timewatch, _watches, uscanner, cout, true, rowCache());
+        cout.flush();
+    }
     void addWatch( string name, string netname )
     {
         list netnames { netname };
-        _watches.push_back( new VectorWatch<1>( name, netnames ) );
+        _watches.push_back( new VectorWatch<1>( name, *_raw, netnames ) );
     }
     template <int sz> void addWatch( string name, string pref, int strt, string suf )
     {
@@ -148,51 +544,161 @@ public:
             cout << "Watch list and template size mismatch for " << name << endl;
             exit(1);
         }
-        _watches.push_back( new VectorWatch<sz>( name, netnames ) );
+        _watches.push_back( new VectorWatch<sz>( name, *_raw, netnames ) );
     }
     void addUWatches(double l, double h, int nsteps)
     {
-        auto allvecnames = ngSpice_AllVecs( ngSpice_CurPlot() );
         UWatch::_l = l;
         UWatch::_h = h;
         UWatch::_nsteps = nsteps;
-        for(int i=0; allvecnames[i]; i++)
+        for(auto& name:_raw->names())
         {
-            auto vecname = allvecnames[i];
-            if ( vecname[0] != 'v' ) continue;
+            auto vecname = name.c_str();
+            if ( vecname[0] != 'v' or vecname[1] != '(' ) continue;
             if ( vecname[2] == 'm' ) continue;
             auto namelen = strlen(vecname);
             if ( vecname[namelen-2] == '#' ) continue; // skip internal nets. their names end in #
             string svecname { &vecname[2], namelen - 3 };
-            _uwatches.push_back( new UWatch(svecname) );
+            _uwatches.push_back( new UWatch(svecname, *_raw) );
         }
     }
+    // Measurements, taken by play() along with the watches or by measure() alone.
+    // Delays and glitches are measured at vdd/2, slews between 10% and 90% of vdd,
+    // and their statistics kept in bins binwidth seconds wide.
+    void addDelay( string name, string from, t_measedge fromedge, string to, t_measedge toedge,
+        double binwidth = 1e-12 )
+    {
+        _meas.push_back( new DelayMeas( name, *_raw, from, fromedge, to, toedge, binwidth ) );
+    }
+    void addSlew( string name, string netname, t_measedge edge = EITHER, double binwidth = 1e-12 )
+    {
+        _meas.push_back( new SlewMeas( name, *_raw, netname, edge, binwidth ) );
+    }
+    // Pulses narrower than maxwidth, e.g. the minimum pulse width with a large maxwidth
+    void addGlitch( string name, string netname, double maxwidth, double binwidth = 1e-12 )
+    {
+        _meas.push_back( new GlitchMeas( name, *_raw, netname, maxwidth, binwidth ) );
+    }
+    // All measurements in one pass over the steps, without playing the watches
+    void measure()
+    {
+        for(auto m:_meas) m->reset();
+        auto steps = _timewatch->steps();
+        for(int i=0; i<steps; i++)
+            for(auto m:_meas) m->step(i);
+    }
+    void reportMeas(ostream& os = cout)
+    {
+        for(auto m:_meas) m->print(os);
+        os.flush();
+    }
     void play()
     {
+#ifdef SPICEPERF
+        auto perfstart = chrono::steady_clock::now();
+#endif
+        UScanner uscanner(_uwatches);
+        for(auto m:_meas) m->reset();
+        playRange(0, _timewatch->steps(), _timewatch, _watches, uscanner, cout, false, rowCache(),
+            _meas.empty() ? NULL : &_meas);
+        cout.flush();
+#ifdef SPICEPERF
+        _perf.playsteps += _timewatch->steps();
+        _perf.playsecs += chrono::duration<double>( chrono::steady_clock::now() - perfstart ).count();
+#endif
+    }
+    // Same output as play, with the time axis split in chunks played by nthreads
+    // threads (0 means all cores). Chunks are printed in order as rounds complete.
+    void play(int nthreads, int chunksteps = 1 << 16)
+    {
+#ifdef SPICEPERF
+        auto perfstart = chrono::steady_clock::now();
+#endif
+        if ( nthreads <= 0 ) nthreads = max( 1u, thread::hardware_concurrency() );
+        auto steps = _timewatch->steps();
+        vector<string> outs(nthreads);
+        vector<thread> threads;
+        for(int from=0; from<steps; )
+        {
+            threads.clear();
+            for(int t=0; t<nthreads and from<steps; t++, from += chunksteps)
+            {
+                auto to = min( steps, from + chunksteps );
+                threads.emplace_back( [this,from,to,&outs,t]() { playChunk(from, to, outs[t]); } );
+            }
+            for(size_t t=0; t<threads.size(); t++)
+            {
+                threads[t].join();
+                cout << outs[t];
+            }
+        }
+        cout.flush();
+#ifdef SPICEPERF
+        _perf.playsteps += steps;
+        _perf.playsecs += chrono::duration<double>( chrono::steady_clock::now() - perfstart ).count();
+#endif
+    }
+    // Same playback as play, but written to a VCD file with change-only encoding.
+    // With uwatches, nets added by addUWatches are exported too, as x while dangling.
+    void exportVcd(string flnm, bool uwatches = false)
+    {
+        VcdWriter vcd(flnm);
+        vector<string> ids, uids;
+        for( auto w:_watches ) ids.push_back( vcd.addVar( w->name(), w->width() ) );
+        if ( uwatches )
+            for( auto u:_uwatches ) uids.push_back( vcd.addVar( u->name(), 1 ) );
+        vcd.endHeader();
+        vector<string> ulast( uids.size() );
         auto steps = _timewatch->steps();
         for(int i=0; i<steps; i++)
         {
-            bool changed = false;
-            for(auto w:_watches)
-                if ( w->nextState(i) ) changed = true;
-            if ( changed )
+            int wi = 0;
+            for( auto w:_watches )
             {
-                _timewatch->nextState(i);
-                report();
+                if ( w->nextState(i) )
+                {
+                    vcd.time( _timewatch->time(i) );
+                    vcd.change( ids[wi], w->bitstr() );
+                }
+                wi++;
+            }
+            int ui = 0;
+            for( auto u:_uwatches )
+            {
+                u->nextState(i);
+                if ( not uwatches ) continue;
+                auto val = u->bitstr();
+                if ( val != ulast[ui] )
+                {
+                    vcd.time( _timewatch->time(i) );
+                    vcd.change( uids[ui], val );
+                    ulast[ui] = val;
+                }
+                ui++;
             }
-            for( auto u:_uwatches ) u->nextState(i);
         }
     }
-    SpiceDbg()
+    SpiceDbg(string rawfile = rawopfile)
     {
-        loadraw();
-        _timewatch = new TimeWatch(); // must be after loadraw
+        _raw = new RawFile(rawfile);
+        _rawfile = rawfile;
+        _timewatch = new TimeWatch(*_raw);
     }
+#ifdef SPICEPERF
+    SpicePerf& perf() { return _perf; }
+#endif
     ~SpiceDbg()
     {
+#ifdef SPICEPERF
+        _perf.finish();
+#endif
         delete _timewatch;
+        delete _idx;
+        delete _cache;
+        delete _raw;
         for(auto w:_watches) delete w;
         for(auto w:_uwatches) delete w;
+        for(auto m:_meas) delete m;
     }
 };
 
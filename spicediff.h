@@ -0,0 +1,252 @@
+#ifndef _SPICEDIFF_H
+#define _SPICEDIFF_H
+
+#include <iostream>
+#include <vector>
+#include <list>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdio.h>
+#include "spiceconf.h"
+#include "spiceraw.h"
+
+using namespace std;
+
+// Digital comparison of the nets of two raw files, e.g. of a design before and
+// after a change. The files need not have the same time steps: each net's logic
+// value is taken as changing at the interpolated logicthresh crossing, and the two
+// are compared as functions of time. Differences lasting up to tol seconds, such
+// as an edge moved by less than tol, are not counted.
+//
+// The samples are streamed once, split into time ranges compared in parallel,
+// keeping only a few values per net, so memory does not grow with the files.
+// Splitting on time rather than on nets has each thread read only its part of the
+// row major files; a difference open across a range boundary is joined up after.
+class RawDiff
+{
+public:
+    typedef struct
+    {
+        string name;
+        uint64_t transa = 0;    // transitions in each file
+        uint64_t transb = 0;
+        uint64_t diffs = 0;     // intervals where the values differed for more than tol
+        double difftime = 0;    // their total length
+        double first = -1;      // start of the first of them, -1 if none
+        bool firsta = false;    // values there
+        bool firstb = false;
+    } t_netdiff;
+private:
+    RawFile _a;
+    RawFile _b;
+    vector<t_netdiff> _results;
+    // State of a net in one time range
+    typedef struct
+    {
+        RawColumn ca, cb;
+        bool va, vb;
+        double since;   // when va and vb last became different
+        bool known;     // since is in this range, else they differed from its start
+        double lead;    // with !known, when that difference ended, -1 if it did not
+        bool leada, leadb;
+        t_netdiff res;  // over the differences that began in the range
+    } t_state;
+    static void error(string msg)
+    {
+        cout << "RawDiff: " << msg << endl;
+        exit(1);
+    }
+    // Time at which the net crossed logicthresh between steps i-1 and i
+    static double crossing(RawColumn& c, RawColumn& time, size_t i)
+    {
+        double v0 = c[i-1], v1 = c[i];
+        if ( v1 == v0 ) return time[i];
+        return time[i-1] + ( logicthresh - v0 ) / ( v1 - v0 ) * ( time[i] - time[i-1] );
+    }
+    static void closeDiff(t_netdiff& r, double since, double t, bool va, bool vb, double tol)
+    {
+        double len = fabs( t - since );
+        if ( len <= tol ) return;
+        r.diffs++;
+        r.difftime += len;
+        if ( r.first < 0 or min( t, since ) < r.first )
+        {
+            r.first = min( t, since );
+            r.firsta = va;
+            r.firstb = vb;
+        }
+    }
+    // One file's net changed value at t, v being va or vb
+    static void change(t_state& s, bool& v, double t, double tol)
+    {
+        if ( s.va == s.vb )
+        {
+            s.since = t;
+            s.known = true;
+        }
+        else if ( s.known ) closeDiff(s.res, s.since, t, s.va, s.vb, tol); // reported with the values before t
+        else
+        {
+            s.lead = t;
+            s.leada = s.va;
+            s.leadb = s.vb;
+            s.known = true; // until the next difference begins
+            s.since = t;
+        }
+        v = not v;
+    }
+    // First step from 1 on at or after t
+    static size_t stepAt(RawColumn& time, size_t n, double t)
+    {
+        size_t lo = 1, hi = n;
+        while ( lo < hi )
+        {
+            auto mid = ( lo + hi ) / 2;
+            if ( time[mid] < t ) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+    // Merges the steps [i,iend) of a and [j,jend) of b in time order, up to end.
+    // The states start with the values of the steps before.
+    static void compareRange(vector<t_state>& states, RawFile& a, RawFile& b, size_t i, size_t iend,
+        size_t j, size_t jend, double end, double tol)
+    {
+        auto ta = a.column("time");
+        auto tb = b.column("time");
+        while ( true )
+        {
+            bool ina = i < iend and ta[i] <= end;
+            bool inb = j < jend and tb[j] <= end;
+            if ( not ina and not inb ) break;
+            if ( ina and ( not inb or ta[i] <= tb[j] ) )
+            {
+                for(auto& s:states)
+                    if ( ( s.ca[i] > logicthresh ) != s.va )
+                    {
+                        s.res.transa++;
+                        change( s, s.va, crossing(s.ca, ta, i), tol );
+                    }
+                i++;
+            }
+            else
+            {
+                for(auto& s:states)
+                    if ( ( s.cb[j] > logicthresh ) != s.vb )
+                    {
+                        s.res.transb++;
+                        change( s, s.vb, crossing(s.cb, tb, j), tol );
+                    }
+                j++;
+            }
+        }
+    }
+public:
+    // Compares nets (all those in both files if empty) in nthreads time ranges, 0
+    // meaning all cores. Results are in the order of nets.
+    vector<t_netdiff>& compare(list<string> nets = {}, double tol = 0, int nthreads = 0)
+    {
+        if ( nets.empty() )
+            for(auto& n:_a.names())
+                if ( n != "time" and _b.has(n) ) nets.push_back(n);
+        for(auto& n:nets)
+            if ( not _a.has(n) or not _b.has(n) ) error( "net " + n + " is not in both files" );
+        _results.assign( nets.size(), t_netdiff() );
+        auto ta = _a.column("time");
+        auto tb = _b.column("time");
+        size_t na = _a.points(), nb = _b.points();
+        int k = 0;
+        for(auto& n:nets) _results[k++].name = n;
+        if ( na == 0 or nb == 0 ) return _results;
+        if ( nthreads <= 0 ) nthreads = max( 1u, thread::hardware_concurrency() );
+        nthreads = min( (size_t) nthreads, na / 1024 + 1 ); // not worth a thread for fewer steps
+        double end = min( ta[na-1], tb[nb-1] );
+        // Range r holds the steps of both files from time split[r] up to split[r+1]
+        vector<double> split(nthreads + 1);
+        split[0] = min( ta[0], tb[0] );
+        for(int r=1; r<nthreads; r++) split[r] = ta[ 1 + r * ( na - 1 ) / nthreads ];
+        split[nthreads] = end;
+        vector<vector<t_state>> ranges(nthreads);
+        vector<thread> threads;
+        for(int r=0; r<nthreads; r++)
+        {
+            size_t i = r ? stepAt(ta, na, split[r]) : 1;
+            size_t j = r ? stepAt(tb, nb, split[r]) : 1;
+            size_t iend = r + 1 < nthreads ? stepAt(ta, na, split[r+1]) : na;
+            size_t jend = r + 1 < nthreads ? stepAt(tb, nb, split[r+1]) : nb;
+            for(auto& n:nets)
+            {
+                t_state s;
+                s.ca = _a.column(n);
+                s.cb = _b.column(n);
+                s.va = s.ca[i-1] > logicthresh;
+                s.vb = s.cb[j-1] > logicthresh;
+                s.since = split[0];
+                s.known = r == 0;
+                s.lead = -1;
+                ranges[r].push_back(s);
+            }
+            threads.emplace_back( [this,&ranges,r,i,iend,j,jend,end,tol]()
+                { compareRange(ranges[r], _a, _b, i, iend, j, jend, end, tol); } );
+        }
+        for(auto& th:threads) th.join();
+        // Sums the ranges, closing the differences that went on from one into the next
+        for(size_t n=0; n<_results.size(); n++)
+        {
+            auto& res = _results[n];
+            double since = 0;
+            bool open = false;
+            for(auto& range:ranges)
+            {
+                auto& s = range[n];
+                res.transa += s.res.transa;
+                res.transb += s.res.transb;
+                res.diffs += s.res.diffs;
+                res.difftime += s.res.difftime;
+                if ( s.res.first >= 0 and ( res.first < 0 or s.res.first < res.first ) )
+                {
+                    res.first = s.res.first;
+                    res.firsta = s.res.firsta;
+                    res.firstb = s.res.firstb;
+                }
+                // a range without changes leaves the difference, or its absence, as it was
+                if ( s.lead >= 0 ) closeDiff(res, since, s.lead, s.leada, s.leadb, tol);
+                if ( s.known )
+                {
+                    open = s.va != s.vb;
+                    since = s.since;
+                }
+            }
+            if ( open ) closeDiff(res, since, end, ranges.back()[n].va, ranges.back()[n].vb, tol);
+        }
+        return _results;
+    }
+    int differing()
+    {
+        return count_if( _results.begin(), _results.end(), [](t_netdiff& r) { return r.diffs > 0; } );
+    }
+    // Differing nets by first divergence, then the summary
+    void report(ostream& os = cout)
+    {
+        vector<t_netdiff*> diffs;
+        for(auto& r:_results)
+            if ( r.diffs ) diffs.push_back(&r);
+        sort( diffs.begin(), diffs.end(), [](t_netdiff *x, t_netdiff *y) { return x->first < y->first; } );
+        char buf[256];
+        for(auto r:diffs)
+        {
+            snprintf( buf, sizeof(buf), "%s first=%g (%d vs %d) diffs=%llu difftime=%g transitions=%llu/%llu\n",
+                r->name.c_str(), r->first, r->firsta, r->firstb, (unsigned long long) r->diffs, r->difftime,
+                (unsigned long long) r->transa, (unsigned long long) r->transb );
+            os << buf;
+        }
+        os << "nets compared=" << _results.size() << " differing=" << diffs.size() << "\n";
+        os.flush();
+    }
+    RawDiff(string rawa, string rawb) : _a(rawa), _b(rawb) {}
+};
+
+#endif
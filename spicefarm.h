@@ -0,0 +1,157 @@
+#ifndef _SPICEFARM_H
+#define _SPICEFARM_H
+
+#include <iostream>
+#include <list>
+#include <vector>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "spiceconf.h"
+
+using namespace std;
+
+// A testbench run in a SpiceFarm worker process. The function builds and runs its
+// SpiceIf (using initfile), fills report and returns pass/fail. Its stdout, which
+// includes ngspice's messages and the trace, goes to logfile (rawfile.log if empty).
+class FarmJob
+{
+public:
+    string name;
+    SpiceConf conf;
+    string initfile;
+    string logfile;
+    function<bool(FarmJob&, string& report)> run;
+};
+
+class FarmResult
+{
+public:
+    string name;
+    bool pass = false;
+    int status = -1;    // exit status of the worker, or the signal that killed it
+    string report;
+    string rawfile;
+    string logfile;
+};
+
+// ngspice's shared library is a per process singleton, so each job is run in a
+// forked worker, at most nworkers at a time. Results come back over a pipe per
+// worker. The parent must not have initialized ngspice itself.
+class SpiceFarm
+{
+    list<FarmJob> _queue;
+    const int _nworkers;
+    typedef struct { pid_t pid; int fd; string data; FarmResult result; } t_worker;
+    [[noreturn]] static void runWorker(FarmJob& job, int fd)
+    {
+        job.conf.apply();
+        auto logfd = open( job.logfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+        if ( logfd >= 0 )
+        {
+            dup2( logfd, STDOUT_FILENO );
+            dup2( logfd, STDERR_FILENO );
+            close(logfd);
+        }
+        string report;
+        bool pass = job.run(job, report);
+        cout.flush();
+        fflush(NULL);
+        // first byte pass flag, followed by the report
+        string msg = string( 1, pass ? '1' : '0' ) + report;
+        for( size_t off = 0; off < msg.size(); )
+        {
+            auto n = write( fd, msg.data() + off, msg.size() - off );
+            if ( n <= 0 ) break;
+            off += n;
+        }
+        close(fd);
+        _exit(0);
+    }
+    t_worker startWorker(FarmJob& job)
+    {
+        if ( job.logfile.empty() ) job.logfile = job.conf.rawopfile + ".log";
+        int fds[2];
+        if ( pipe(fds) )
+        {
+            cout << "SpiceFarm: pipe failed" << endl;
+            exit(1);
+        }
+        cout.flush();
+        fflush(NULL);
+        auto pid = fork();
+        if ( pid < 0 )
+        {
+            cout << "SpiceFarm: fork failed" << endl;
+            exit(1);
+        }
+        if ( pid == 0 )
+        {
+            close(fds[0]);
+            runWorker(job, fds[1]);
+        }
+        close(fds[1]);
+        t_worker w { pid, fds[0], "", FarmResult() };
+        w.result.name = job.name;
+        w.result.rawfile = job.conf.rawopfile;
+        w.result.logfile = job.logfile;
+        return w;
+    }
+    static void finishWorker(t_worker& w)
+    {
+        close(w.fd);
+        int wstatus;
+        waitpid(w.pid, &wstatus, 0);
+        w.result.status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : WTERMSIG(wstatus);
+        bool ok = WIFEXITED(wstatus) and WEXITSTATUS(wstatus) == 0 and not w.data.empty();
+        w.result.pass = ok and w.data[0] == '1';
+        if ( not w.data.empty() ) w.result.report = w.data.substr(1);
+    }
+public:
+    void add(FarmJob job) { _queue.push_back(job); }
+    // Runs all queued jobs, results are in the order the jobs were added
+    vector<FarmResult> run()
+    {
+        vector<FarmResult> results( _queue.size() );
+        vector<t_worker> workers;
+        vector<int> jobidx;
+        int nextjob = 0;
+        while ( not _queue.empty() or not workers.empty() )
+        {
+            while ( not _queue.empty() and (int) workers.size() < _nworkers )
+            {
+                workers.push_back( startWorker( _queue.front() ) );
+                jobidx.push_back( nextjob++ );
+                _queue.pop_front();
+            }
+            vector<pollfd> pfds;
+            for(auto& w:workers) pfds.push_back( { w.fd, POLLIN, 0 } );
+            if ( poll( pfds.data(), pfds.size(), -1 ) < 0 ) continue;
+            for(int i=workers.size()-1; i>=0; i--)
+            {
+                if ( not pfds[i].revents ) continue;
+                char buf[4096];
+                auto n = read( workers[i].fd, buf, sizeof(buf) );
+                if ( n > 0 )
+                {
+                    workers[i].data.append(buf, n);
+                    continue;
+                }
+                finishWorker(workers[i]);
+                results[ jobidx[i] ] = workers[i].result;
+                workers.erase( workers.begin() + i );
+                jobidx.erase( jobidx.begin() + i );
+            }
+        }
+        return results;
+    }
+    // nworkers 0 means one per core
+    SpiceFarm(int nworkers = 0) :
+        _nworkers( nworkers > 0 ? nworkers : max( 1L, sysconf(_SC_NPROCESSORS_ONLN) ) ) {}
+};
+
+#endif
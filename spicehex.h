@@ -0,0 +1,121 @@
+#ifndef _SPICEHEX_H
+#define _SPICEHEX_H
+
+#include <bitset>
+#include <string>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+// Value of each character as a hex digit, -1 if it is not one
+constexpr array<int8_t,256> hexCharVals()
+{
+    array<int8_t,256> vals {};
+    for(int c=0; c<256; c++) vals[c] = -1;
+    for(int c='0'; c<='9'; c++) vals[c] = c - '0';
+    for(int c='a'; c<='f'; c++) vals[c] = vals[ c - 'a' + 'A' ] = c - 'a' + 10;
+    return vals;
+}
+
+// Conversions between hex / binary strings (MSB first) and arrays of 64 bit words
+// (LSB first), one table lookup per character
+class HexUtils
+{
+    static constexpr array<int8_t,256> _hexvals = hexCharVals();
+    static constexpr char _hexdigits[] = "0123456789abcdef";
+public:
+    static int hexStrlen(int sz) { return ( sz + 3 ) / 4;  }
+    static void words2hexstr(const uint64_t *words, int nbits, char *dest)
+    {
+        auto hexlen = hexStrlen(nbits);
+        for( int ni = 0; ni < hexlen; ni++ )
+            dest[ hexlen - 1 - ni ] = _hexdigits[ ( words[ ni >> 4 ] >> ( ( ni & 15 ) * 4 ) ) & 15 ];
+    }
+    static string words2hexstr(const uint64_t *words, int nbits)
+    {
+        string retstr( hexStrlen(nbits), '0' );
+        words2hexstr( words, nbits, &retstr[0] );
+        return retstr;
+    }
+    static string words2binstr(const uint64_t *words, int nbits)
+    {
+        string retstr( nbits, '0' );
+        for( int bi = 0; bi < nbits; bi++ )
+            retstr[ nbits - 1 - bi ] = '0' + ( ( words[ bi >> 6 ] >> ( bi & 63 ) ) & 1 );
+        return retstr;
+    }
+    // src is len characters, the last one being the LSB. Bits beyond nbits are
+    // dropped. Returns false on an invalid character.
+    static bool hexstr2words(const char *src, int len, uint64_t *words, int nbits)
+    {
+        fill( words, words + ( nbits + 63 ) / 64, 0 );
+        for( int ni = 0; ni < len and ni * 4 < nbits; ni++ )
+        {
+            auto nib = _hexvals[ (uint8_t) src[ len - 1 - ni ] ];
+            if ( nib < 0 ) return false;
+            words[ ni >> 4 ] |= uint64_t(nib) << ( ( ni & 15 ) * 4 );
+        }
+        if ( nbits & 63 ) words[ nbits >> 6 ] &= ( uint64_t(1) << ( nbits & 63 ) ) - 1;
+        return true;
+    }
+    static bool binstr2words(const char *src, int len, uint64_t *words, int nbits)
+    {
+        fill( words, words + ( nbits + 63 ) / 64, 0 );
+        for( int bi = 0; bi < len; bi++ )
+        {
+            auto c = src[ len - 1 - bi ];
+            if ( c != '0' and c != '1' ) return false;
+            if ( bi < nbits ) words[ bi >> 6 ] |= uint64_t( c - '0' ) << ( bi & 63 );
+        }
+        return true;
+    }
+    template <int sz> static void bitset2words(const bitset<sz>& bits, uint64_t *words)
+    {
+        const bitset<sz> mask( ~0ULL );
+        for(int wi=0; wi * 64 < sz; wi++)
+            words[wi] = ( ( bits >> ( wi * 64 ) ) & mask ).to_ullong();
+    }
+    template <int sz> string bitset2hexstr(bitset<sz>& bits)
+    {
+        uint64_t words[ ( sz + 63 ) / 64 ];
+        bitset2words<sz>(bits, words);
+        return words2hexstr(words, sz);
+    }
+};
+
+// Value of an sz bit bus as words, LSB first. Bits above sz are kept 0 so that
+// words can be compared as a whole.
+template <int sz> class WideWord
+{
+public:
+    static constexpr int nwords = ( sz + 63 ) / 64;
+    uint64_t w[nwords] = {};
+    bool bit(int i) const { return ( w[ i >> 6 ] >> ( i & 63 ) ) & 1; }
+    void setbit(int i, bool val)
+    {
+        uint64_t mask = uint64_t(1) << ( i & 63 );
+        if ( val ) w[ i >> 6 ] |= mask;
+        else w[ i >> 6 ] &= ~mask;
+    }
+    bool operator==(const WideWord& other) const { return equal( w, w + nwords, other.w ); }
+    bool operator!=(const WideWord& other) const { return not ( *this == other ); }
+    string hexstr() const { return HexUtils::words2hexstr(w, sz); }
+    string binstr() const { return HexUtils::words2binstr(w, sz); }
+    bool setHex(const string& s) { return HexUtils::hexstr2words( s.data(), s.size(), w, sz ); }
+    bool setBin(const string& s) { return HexUtils::binstr2words( s.data(), s.size(), w, sz ); }
+    void setWords(const uint64_t *words)
+    {
+        copy( words, words + nwords, w );
+        if ( sz & 63 ) w[ nwords - 1 ] &= ( uint64_t(1) << ( sz & 63 ) ) - 1;
+    }
+    WideWord(unsigned long val)
+    {
+        w[0] = val;
+        if ( sz < 64 ) w[0] &= ( uint64_t(1) << ( sz & 63 ) ) - 1;
+    }
+    WideWord() {}
+};
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef _SPICEIDX_H
+#define _SPICEIDX_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "spiceconf.h"
+#include "spiceraw.h"
+
+using namespace std;
+
+// Digital transitions of all variables of a raw file, built in one pass over the
+// samples and kept in a sidecar file (rawfile.idx) for later sessions. Per
+// variable the steps where its logic value changes are stored as varint coded
+// deltas, with a skip entry every 64 transitions. A sampled copy of the time
+// column narrows time lookups to one block of the raw file.
+//
+// Sidecar: "SPIDX002" u64 raw file size, i64 raw file mtime in ns, f64 logicthresh,
+// u64 points, u32 vars, then per variable u8 initial value, u64 transitions,
+// u64 bytes, bytes of deltas.
+class RawIndex
+{
+    static const int _timeblock = 1024; // steps per sampled time
+    static const int _skipevery = 64;   // transitions per skip entry
+    typedef struct { int64_t step; uint64_t ofs; } t_skip;
+    typedef struct
+    {
+        bool initial;
+        uint64_t ntrans = 0;
+        vector<uint8_t> deltas;
+        vector<t_skip> skips;   // step and offset of transitions 0, 64, 128 ...
+    } t_netidx;
+    RawFile& _raw;
+    RawColumn _time;
+    vector<double> _blocktimes;
+    vector<t_netidx> _nets;
+    static void putVarint(vector<uint8_t>& buf, uint64_t v)
+    {
+        while ( v >= 0x80 )
+        {
+            buf.push_back( uint8_t(v) | 0x80 );
+            v >>= 7;
+        }
+        buf.push_back(v);
+    }
+    static uint64_t getVarint(const vector<uint8_t>& buf, uint64_t& ofs)
+    {
+        uint64_t v = 0;
+        for(int shift=0; ; shift+=7)
+        {
+            auto b = buf[ofs++];
+            v |= uint64_t( b & 0x7f ) << shift;
+            if ( not ( b & 0x80 ) ) return v;
+        }
+    }
+    static void error(string msg)
+    {
+        cout << "RawIndex: " << msg << endl;
+        exit(1);
+    }
+    void build()
+    {
+        auto nvars = _raw.vars();
+        auto npoints = _raw.points();
+        _nets.assign( nvars, t_netidx() );
+        vector<RawColumn> cols;
+        for(int v=0; v<nvars; v++) cols.push_back( _raw.column(v) );
+        vector<bool> prev(nvars);
+        vector<int64_t> last(nvars, -1);
+        for(size_t i=0; i<npoints; i++)
+            for(int v=0; v<nvars; v++)
+            {
+                bool val = cols[v][i] > logicthresh;
+                if ( i == 0 ) _nets[v].initial = val;
+                else if ( val != prev[v] )
+                {
+                    putVarint( _nets[v].deltas, i - last[v] );
+                    last[v] = i;
+                    _nets[v].ntrans++;
+                }
+                prev[v] = val;
+            }
+    }
+    // Whether the deltas read from a sidecar are exactly ntrans varints of at least 1
+    // that stay below points, so that the unchecked getVarint can walk them
+    static bool validDeltas(const t_netidx& n, uint64_t points)
+    {
+        auto& buf = n.deltas;
+        uint64_t ofs = 0, step = 0;
+        for(uint64_t k=0; k<n.ntrans; k++)
+        {
+            uint64_t v = 0;
+            for(int shift=0; ; shift+=7)
+            {
+                if ( ofs == buf.size() or shift > 63 ) return false;
+                auto b = buf[ofs++];
+                v |= uint64_t( b & 0x7f ) << shift;
+                if ( not ( b & 0x80 ) ) break;
+            }
+            // the first delta counts from step -1
+            if ( v == 0 or v > points ) return false;
+            step += v;
+            if ( step > points ) return false;
+        }
+        return ofs == buf.size();
+    }
+    // The skip tables are not stored, they come from one walk over the deltas
+    void buildSkips()
+    {
+        for(auto& n:_nets)
+        {
+            n.skips.clear();
+            int64_t step = -1;
+            uint64_t ofs = 0;
+            for(uint64_t k=0; k<n.ntrans; k++)
+            {
+                auto at = ofs;
+                step += getVarint(n.deltas, ofs);
+                if ( k % _skipevery == 0 ) n.skips.push_back( { step, at } );
+            }
+        }
+    }
+    template <typename T> static void put(FILE *fp, T val) { fwrite( &val, sizeof(T), 1, fp ); }
+    template <typename T> static bool get(FILE *fp, T& val) { return fread( &val, sizeof(T), 1, fp ) == 1; }
+    static void rawStat(string rawfile, uint64_t& size, int64_t& mtime)
+    {
+        struct stat st;
+        if ( stat( rawfile.c_str(), &st ) ) error( "could not stat " + rawfile );
+        size = st.st_size;
+        // in ns, as a rerun within the same second often leaves the same size
+        mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    }
+    void save(string rawfile, string idxfile)
+    {
+        uint64_t size;
+        int64_t mtime;
+        rawStat(rawfile, size, mtime);
+        // the index is only a cache, it is left out on any error. Written under a
+        // unique temporary name, as other processes may be indexing the same file.
+        string tmpfile = idxfile + ".XXXXXX";
+        int fd = mkstemp( &tmpfile[0] );
+        if ( fd < 0 ) return;
+        fchmod( fd, 0644 );
+        auto fp = fdopen( fd, "wb" );
+        if ( fp == NULL )
+        {
+            close(fd);
+            unlink( tmpfile.c_str() );
+            return;
+        }
+        fwrite( "SPIDX002", 8, 1, fp );
+        put<uint64_t>(fp, size);
+        put<int64_t>(fp, mtime);
+        put<double>(fp, logicthresh);
+        put<uint64_t>(fp, _raw.points());
+        put<uint32_t>(fp, _nets.size());
+        for(auto& n:_nets)
+        {
+            put<uint8_t>(fp, n.initial);
+            put<uint64_t>(fp, n.ntrans);
+            put<uint64_t>(fp, n.deltas.size());
+            fwrite( n.deltas.data(), 1, n.deltas.size(), fp );
+        }
+        bool ok = not ferror(fp);
+        if ( fclose(fp) ) ok = false;
+        if ( not ok or rename( tmpfile.c_str(), idxfile.c_str() ) ) unlink( tmpfile.c_str() );
+    }
+    // false if there is no sidecar, it does not match the raw file or is damaged
+    bool load(string rawfile, string idxfile)
+    {
+        auto fp = fopen( idxfile.c_str(), "rb" );
+        if ( fp == NULL ) return false;
+        struct stat st;
+        if ( fstat( fileno(fp), &st ) )
+        {
+            fclose(fp);
+            return false;
+        }
+        uint64_t size, rawsize, points;
+        int64_t mtime, rawmtime;
+        double thresh;
+        uint32_t nvars;
+        char magic[8];
+        rawStat(rawfile, rawsize, rawmtime);
+        bool ok = fread( magic, 8, 1, fp ) == 1 and memcmp( magic, "SPIDX002", 8 ) == 0
+            and get(fp, size) and get(fp, mtime) and get(fp, thresh) and get(fp, points) and get(fp, nvars)
+            and size == rawsize and mtime == rawmtime and thresh == logicthresh
+            and points == _raw.points() and (int) nvars == _raw.vars();
+        if ( ok )
+        {
+            _nets.assign( nvars, t_netidx() );
+            for(auto& n:_nets)
+            {
+                uint8_t initial;
+                uint64_t nbytes;
+                if ( not ( get(fp, initial) and get(fp, n.ntrans) and get(fp, nbytes) ) ) { ok = false; break; }
+                n.initial = initial;
+                if ( nbytes > (uint64_t) st.st_size - ftell(fp) ) { ok = false; break; }
+                n.deltas.resize(nbytes);
+                if ( fread( n.deltas.data(), 1, nbytes, fp ) != nbytes ) { ok = false; break; }
+                if ( not validDeltas(n, points) ) { ok = false; break; }
+            }
+        }
+        fclose(fp);
+        return ok;
+    }
+    t_netidx& net(string name)
+    {
+        auto col = _raw.col(name);
+        if ( col < 0 ) error( "no variable named " + name );
+        return _nets[col];
+    }
+    // Index of the first transition after step and its step in tstep, ntrans if none
+    uint64_t transitionAfter(t_netidx& n, int64_t step, int64_t& tstep)
+    {
+        auto it = upper_bound( n.skips.begin(), n.skips.end(), step,
+            [](int64_t s, const t_skip& sk) { return s < sk.step; } );
+        if ( it == n.skips.begin() )
+        {
+            if ( n.ntrans ) tstep = it->step;
+            return 0;
+        }
+        // decode onwards from the last skip entry at or before step
+        --it;
+        uint64_t k = ( it - n.skips.begin() ) * _skipevery;
+        uint64_t ofs = it->ofs;
+        int64_t s = it->step;
+        getVarint(n.deltas, ofs);
+        for(k++; k<n.ntrans; k++)
+        {
+            s += getVarint(n.deltas, ofs);
+            if ( s > step )
+            {
+                tstep = s;
+                return k;
+            }
+        }
+        return n.ntrans;
+    }
+public:
+    int steps() { return _raw.points(); }
+    double time(int step) { return _time[step]; }
+    // First step at or after time t, steps() if none
+    int stepAt(double t)
+    {
+        // blocktimes holds the last time of each whole block
+        int lo = ( lower_bound( _blocktimes.begin(), _blocktimes.end(), t ) - _blocktimes.begin() ) * _timeblock;
+        int hi = min( lo + _timeblock, steps() );
+        while ( lo < hi )
+        {
+            int mid = ( lo + hi ) / 2;
+            if ( _time[mid] < t ) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+    // Last step at or before time t, -1 if none
+    int stepBefore(double t)
+    {
+        auto s = stepAt(t);
+        return s < steps() and _time[s] == t ? s : s - 1;
+    }
+    // Logic value at step, from the initial value and the parity of the transitions
+    bool valueAtStep(string name, int step)
+    {
+        auto& n = net(name);
+        int64_t tstep;
+        auto k = transitionAfter(n, step, tstep);
+        return n.initial ^ ( k & 1 );
+    }
+    // First step after step where the net changes, -1 if none
+    int nextEdgeStep(string name, int step)
+    {
+        auto& n = net(name);
+        int64_t tstep;
+        auto k = transitionAfter(n, step, tstep);
+        return k < n.ntrans ? tstep : -1;
+    }
+    uint64_t transitions(string name) { return net(name).ntrans; }
+    // Uses idxfile (rawfile.idx if empty) if it matches rawfile, else indexes
+    // rawfile and writes idxfile
+    RawIndex(RawFile& raw, string rawfile, string idxfile = "") : _raw(raw)
+    {
+        if ( idxfile.empty() ) idxfile = rawfile + ".idx";
+        _time = _raw.column("time");
+        for(int i=_timeblock; i<=steps(); i+=_timeblock) _blocktimes.push_back( _time[i-1] );
+        if ( not load(rawfile, idxfile) )
+        {
+            build();
+            save(rawfile, idxfile);
+        }
+        buildSkips();
+    }
+};
+
+#endif
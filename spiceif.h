@@ -3,18 +3,46 @@
 
 #include <iostream>
 #include <map>
+#include <set>
 #include <vector>
 #include <list>
 #include <bitset>
 #include <string>
+#include <sstream>
 #include <algorithm>
+#include <functional>
+#include <queue>
+#include <deque>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <atomic>
+#include <dlfcn.h>
+#include <unistd.h>
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include <ngspice/sharedspice.h>
 #include "spiceconf.h"
+#include "spicehex.h"
+#include "spicetrace.h"
+#include "spicetrim.h"
+#include "spiceraw.h"
+#ifdef SPICEPERF
+#include "spiceperf.h"
+#endif
 
 using namespace std;
 
 typedef map<string,unsigned> t_vecid;
 typedef enum { IN, OUT } t_dir; // OUT is a misnomer, it just means non IN
+// What SpiceIf::runBg does when the frame queue is full: make the solver wait, or
+// fold the step's changes into the next frame that fits
+typedef enum { BP_BLOCK, BP_COALESCE } t_backpressure;
+typedef enum { RISING, FALLING, CHANGE } t_edge;
+// Scheduled actions return true if they changed inputs, same as handleEvent
+typedef function<bool()> t_action;
 
 class EventHandler
 {
@@ -22,9 +50,25 @@ public:
     virtual bool handleEvent(bool)=0;
 };
 
+class ScalarNet;
+
+// Entry points of the ngspice library an instance talks to
+typedef struct
+{
+    int (*init)(SendChar*, SendStat*, ControlledExit*, SendData*, SendInitData*, BGThreadRunning*, void*);
+    int (*initSync)(GetVSRCData*, GetISRCData*, GetSyncData*, int*, void*);
+    int (*command)(char*);
+} t_ngapi;
+
 class SpiceIfBase
 {
 protected:
+    // The linked libngspice by default, else a private copy (see loadLib)
+    t_ngapi _ng = { ngSpice_Init, ngSpice_Init_Sync, ngSpice_Command };
+    void *_lib = NULL;
+    string _rawfile = rawopfile;
+    bool _loaded = false;   // set by end(), circbyline doesn't apply after that
+    string _runcmd = "run";
     virtual int fnSendChar(char *str)
     {
         cout << str << endl;
@@ -82,33 +126,59 @@ public:
         cout << "SpiceIfBase::save unimplemented" << endl;
         exit(1);
     }
-    void sendCmd(string cmd)
+    // Registers an external voltage source, returns its index
+    virtual int addVsrc(ScalarNet*)
+    {
+        cout << "SpiceIfBase::addVsrc unimplemented" << endl;
+        exit(1);
+    }
+    // Sends a precompiled source for the input net instead of an external one,
+    // false if there is none for it
+    virtual bool sendStimulus(string) { return false; }
+    // Nonzero if ngspice rejected the command
+    int sendCmd(string cmd)
     {
 #ifdef SPICEDBG
         cout << "Cmd:" << cmd << endl;
         cout.flush();
 #endif
-        ngSpice_Command(const_cast<char*>(cmd.c_str()));
+        return _ng.command(const_cast<char*>(cmd.c_str()));
     }
     void sendCircCmd(string cmd) { sendCmd( string("circbyline ") + cmd ); }
     void writeraw( list<string> veclist = {} )
     {
-        string cmd = "write " + rawopfile;
+        string cmd = "write " + _rawfile;
         for( auto v:veclist ) cmd = cmd + " " + v;
         sendCmd(cmd);
     }
-    void loadraw() { sendCmd(string("load ")+rawopfile); }
+    void loadraw() { sendCmd(string("load ")+_rawfile); }
+    // Raw file of this instance for writeraw / loadraw, rawopfile by default
+    void setRawFile(string flnm) { _rawfile = flnm; }
+    string rawFile() { return _rawfile; }
     // Right command to use is 'source' with sendCmd, but with at the circbyline commands
     // that follow are getting ignored, which is strange, .include seems to work though
     void sourceFile(string flnm) { sendCircCmd(".include " + flnm); }
+    // Sources the circuit along with only the parts of the library section it uses,
+    // in place of .lib libfile section and a separately trimmed models file
+    void sourceTrimmed(string libfile, string section, string cktfile, string cachedir = ".")
+    {
+        sourceFile( SpiceTrim::trim( libfile, section, {cktfile}, cachedir ) );
+        sourceFile(cktfile);
+    }
     // sendCmd doesn't work for initComment, tried
     void initComment() { sendCircCmd("* spiceif simulation"); }
     void setVdd() { sendCircCmd( string("Vdd Vdd 0 DC ") + vddstr ); }
-    void end() { sendCircCmd(".end"); }
+    void end()
+    {
+        sendCircCmd(".end");
+        _loaded = true;
+    }
     // It was observed that putting .tran directly in initfile does not work correctly
+    // Once the circuit is loaded, it sets the analysis for the next run instead
     void tran(string step, string stop)
     {
-        sendCircCmd( string(".tran ") + step + " " + stop );
+        if ( _loaded ) _runcmd = string("tran ") + step + " " + stop;
+        else sendCircCmd( string(".tran ") + step + " " + stop );
     }
     void initSpice()
     {
@@ -132,13 +202,59 @@ public:
 
         void *userData = this;
 
-        ngSpice_Init( printfcn, statfcn, ngexit, sdata, sinitdata, bgtrun, userData );
+        _ng.init( printfcn, statfcn, ngexit, sdata, sinitdata, bgtrun, userData );
+    }
+    // ngspice keeps its state in globals, so each concurrent simulation needs its own
+    // copy of the library. dlopen maps a file only once, hence a copy of libpath
+    // under a fresh name, unlinked once loaded. RTLD_DEEPBIND keeps the copy's calls
+    // to itself from going to a libngspice linked into the program.
+    void loadLib(string libpath)
+    {
+        char tmpname[] = "/tmp/libngspice_XXXXXX";
+        int fd = mkstemp(tmpname);
+        if ( fd < 0 )
+        {
+            cout << "SpiceIfBase: could not create a copy of " << libpath << endl;
+            exit(1);
+        }
+        close(fd);
+        {
+            ifstream src( libpath, ios::binary );
+            ofstream dest( tmpname, ios::binary );
+            if ( not src or not ( dest << src.rdbuf() ) )
+            {
+                unlink(tmpname);
+                cout << "SpiceIfBase: could not copy " << libpath << " to " << tmpname << endl;
+                exit(1);
+            }
+        }
+        _lib = dlopen( tmpname, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND );
+        unlink(tmpname);
+        if ( _lib == NULL )
+        {
+            cout << "SpiceIfBase: dlopen " << libpath << " failed: " << dlerror() << endl;
+            exit(1);
+        }
+        _ng.init = (decltype(_ng.init)) dlsym( _lib, "ngSpice_Init" );
+        _ng.initSync = (decltype(_ng.initSync)) dlsym( _lib, "ngSpice_Init_Sync" );
+        _ng.command = (decltype(_ng.command)) dlsym( _lib, "ngSpice_Command" );
+        if ( _ng.init == NULL or _ng.initSync == NULL or _ng.command == NULL )
+        {
+            cout << "SpiceIfBase: " << libpath << " is not an ngspice shared library" << endl;
+            exit(1);
+        }
     }
 
-    SpiceIfBase()
+    // With libpath empty the linked libngspice is used, which allows only one
+    // instance per process. Otherwise the instance runs on a private copy of libpath.
+    SpiceIfBase(string libpath = "")
     {
+        if ( not libpath.empty() ) loadLib(libpath);
         initSpice();
     }
+    // The private copy is not dlclose'd: ngspice's background thread and atexit
+    // handlers may still refer to it
+    virtual ~SpiceIfBase() {}
 };
 
 /* suggested contents for initfile to be sent to the constructor
@@ -154,40 +270,256 @@ public:
 * load your circuit
 .include myckt.spice
 
+Alternatively leave out all three and call sourceTrimmed after constructing SpiceIf, e.g.
+spiceif.sourceTrimmed("<path/to/>sky130.lib.spice", "tt", "myckt.spice");
+
 */
 
-class HexUtils
+// Flat table of all watched nets, compiled on every Init callback. Each scalar
+// net owns a slot; per step the slots' values are gathered from vecsa into a
+// contiguous array, thresholded 64 at a time into packed words and compared
+// with the previous words by XOR. Nets merely read their slot from here.
+class WatchTable
 {
+    vector<int> _vecids;            // vector index per slot, -1 if not activated
+    vector<double> _reals;          // analog value per slot, padded to whole words
+    vector<uint64_t> _bits;         // logic value per slot, 64 slots per word
+    vector<uint64_t> _diff;         // slots that changed in the last update
+    vector<uint64_t> _watchmask;    // slots which participate in change detection
+    vector<uint64_t> _activemask;
+    vector<int> _gatherslots;       // compiled list of activated slots ...
+    vector<int> _gathervecids;      // ... and their vector indices
+    int _maxvecid = -1;
+    bool _primed = false;
+    int _nslots = 0;
+    uint64_t _changes = 0;          // values changed by set and setWord
+    static int nwords(int nslots) { return ( nslots + 63 ) / 64; }
+    static bool bit(const vector<uint64_t>& words, int slot)
+    {
+        return ( words[ slot >> 6 ] >> ( slot & 63 ) ) & 1;
+    }
+    static void setbit(vector<uint64_t>& words, int slot, bool val)
+    {
+        uint64_t mask = uint64_t(1) << ( slot & 63 );
+        if ( val ) words[ slot >> 6 ] |= mask;
+        else words[ slot >> 6 ] &= ~mask;
+    }
+    // Kernel: 64 doubles to one word of (value > logicthresh) bits
+    static uint64_t threshold(const double *r)
+    {
+        uint64_t word = 0;
+#if defined(__AVX__)
+        auto th = _mm256_set1_pd(logicthresh);
+        for(int j=0; j<64; j+=4)
+            word |= uint64_t( _mm256_movemask_pd(
+                _mm256_cmp_pd( _mm256_loadu_pd(r+j), th, _CMP_GT_OQ ) ) ) << j;
+#elif defined(__SSE2__)
+        auto th = _mm_set1_pd(logicthresh);
+        for(int j=0; j<64; j+=2)
+            word |= uint64_t( _mm_movemask_pd( _mm_cmpgt_pd( _mm_loadu_pd(r+j), th ) ) ) << j;
+#else
+        for(int j=0; j<64; j++)
+            word |= uint64_t( r[j] > logicthresh ) << j;
+#endif
+        return word;
+    }
 public:
-    int hexStrlen(int sz) { return ( sz + 3 ) / 4;  }
-    template <int sz> string bitset2hexstr(bitset<sz>& bits)
+    int addSlot(bool watched = true)
+    {
+        int slot = _nslots++;
+        _vecids.push_back(-1);
+        auto nw = nwords(_nslots);
+        _reals.resize( nw * 64, 0 );
+        _bits.resize(nw);
+        _diff.resize(nw);
+        _watchmask.resize(nw);
+        _activemask.resize(nw);
+        setbit(_watchmask, slot, watched);
+        return slot;
+    }
+    void unbindAll()
+    {
+        fill( _vecids.begin(), _vecids.end(), -1 );
+        fill( _activemask.begin(), _activemask.end(), 0 );
+        _gatherslots.clear();
+        _gathervecids.clear();
+        _maxvecid = -1;
+    }
+    void bind(int slot, int vecid)
+    {
+        _vecids[slot] = vecid;
+        setbit(_activemask, slot, true);
+    }
+    // To be called after all nets are (re)activated
+    void compile()
+    {
+        _gatherslots.clear();
+        _gathervecids.clear();
+        _maxvecid = -1;
+        for(int slot=0; slot<_nslots; slot++)
+            if ( _vecids[slot] >= 0 )
+            {
+                _gatherslots.push_back(slot);
+                _gathervecids.push_back(_vecids[slot]);
+                _maxvecid = max( _maxvecid, _vecids[slot] );
+            }
+        _primed = false;
+    }
+    // For an analysis with the same vectors as the last compile
+    void restart() { _primed = false; }
+    int words() { return _bits.size(); }
+    // false until the first update after compile, which reports all slots as changed
+    bool primed() { return _primed; }
+    const vector<uint64_t>& diffs() { return _diff; }
+    // Gathers a step into reals and thresholds it into bits, with the changes
+    // against prev in diff. prev may be the same as bits. Returns true on any change.
+    bool digitize(pvecvaluesall vecs, double *reals, const uint64_t *prev, uint64_t *bits, uint64_t *diff)
+    {
+        if ( _maxvecid >= vecs->veccount )
+        {
+            cout << "WatchTable: vector index " << _maxvecid
+                << " beyond veccount=" << vecs->veccount
+                << " exiting..." << endl;
+            exit(1);
+        }
+        auto vecsa = vecs->vecsa;
+        auto nactive = _gatherslots.size();
+        for(size_t k=0; k<nactive; k++)
+            reals[ _gatherslots[k] ] = vecsa[ _gathervecids[k] ]->creal;
+        uint64_t anydiff = 0;
+        for(size_t wi=0; wi<_bits.size(); wi++)
+        {
+            auto word = threshold( &reals[ wi * 64 ] );
+            auto mask = _watchmask[wi] & _activemask[wi];
+            auto wdiff = ( _primed ? word ^ prev[wi] : ~uint64_t(0) ) & mask;
+            bits[wi] = word;
+            diff[wi] = wdiff;
+            anydiff |= wdiff;
+        }
+        _primed = true;
+        return anydiff != 0;
+    }
+    // Returns true if any watched slot changed its logic value
+    bool update(pvecvaluesall vecs)
+    {
+        return digitize( vecs, _reals.data(), _bits.data(), _bits.data(), _diff.data() );
+    }
+    // Makes a frame digitized elsewhere the current state. Slots that are not
+    // activated keep the values they were set to.
+    void load(const uint64_t *bits, const uint64_t *diff)
     {
-        auto hexlen = hexStrlen(sz);
-        string retstr (hexlen,'0');
-        char int2hex[] = "0123456789abcdef";
-        for( int desti = hexlen - 1, bi = 0; desti >= 0; desti-- )
+        for(size_t wi=0; wi<_bits.size(); wi++)
         {
-            int nibval = 0;
-            for( int nibi=0; nibi < 4 and bi < sz; nibi++, bi++ )
-                nibval |= ( bits[bi] ? 1 : 0 ) << nibi;
-            retstr[ desti ] = int2hex[ nibval ];
+            _bits[wi] = ( _bits[wi] & ~_activemask[wi] ) | ( bits[wi] & _activemask[wi] );
+            _diff[wi] = diff[wi];
         }
-        return retstr;
+    }
+    bool isActive(int slot) { return _vecids[slot] >= 0; }
+    bool logicval(int slot) { return bit(_bits, slot); }
+    double realval(int slot) { return _reals[slot]; }
+    bool changed(int slot) { return bit(_diff, slot); }
+    // Counts values set and setWord changed, i.e. input nets' when set by the user
+    uint64_t changes() { return _changes; }
+    void set(int slot, double realval)
+    {
+        if ( _reals[slot] != realval ) _changes++;
+        _reals[slot] = realval;
+        setbit(_bits, slot, realval > logicthresh);
+    }
+    // Sets n <= 64 slots starting at slot to hi or 0 as per the bits of word
+    void setWord(int slot, int n, uint64_t word, double hi)
+    {
+        for(int i=0; i<n; i++)
+        {
+            double v = hi * double( ( word >> i ) & 1 );
+            if ( _reals[ slot + i ] != v ) _changes++;
+            _reals[ slot + i ] = v;
+        }
+        uint64_t mask = n == 64 ? ~uint64_t(0) : ( uint64_t(1) << n ) - 1;
+        word = hi > logicthresh ? word & mask : 0;
+        auto wi = slot >> 6;
+        auto off = slot & 63;
+        _bits[wi] = ( _bits[wi] & ~( mask << off ) ) | ( word << off );
+        if ( off and off + n > 64 )
+            _bits[wi+1] = ( _bits[wi+1] & ~( mask >> ( 64 - off ) ) ) | ( word >> ( 64 - off ) );
+    }
+    // n <= 64 logic values starting at slot, packed with slot at bit 0
+    uint64_t extract(int slot, int n)
+    {
+        auto wi = slot >> 6;
+        auto off = slot & 63;
+        uint64_t val = _bits[wi] >> off;
+        if ( off and off + n > 64 ) val |= _bits[wi+1] << ( 64 - off );
+        return n == 64 ? val : val & ( ( uint64_t(1) << n ) - 1 );
+    }
+    template <int sz> bitset<sz> bits(int slot)
+    {
+        bitset<sz> retbits;
+        for(int i=0; i<sz; i+=64)
+            retbits |= bitset<sz>( extract( slot + i, min( 64, sz - i ) ) ) << i;
+        return retbits;
     }
 };
 
+// Single producer single consumer queue of fixed size frames of words
+class FrameRing
+{
+    vector<uint64_t> _buf;
+    const size_t _framewords;
+    const size_t _nframes;
+    alignas(64) atomic<size_t> _head {0}; // advanced by producer
+    alignas(64) atomic<size_t> _tail {0}; // advanced by consumer
+public:
+    // Next free frame, NULL if full. Becomes visible to the consumer on publish.
+    uint64_t* claim()
+    {
+        auto head = _head.load(memory_order_relaxed);
+        if ( head - _tail.load(memory_order_acquire) == _nframes ) return NULL;
+        return &_buf[ ( head % _nframes ) * _framewords ];
+    }
+    void publish() { _head.store( _head.load(memory_order_relaxed) + 1, memory_order_release ); }
+    // Oldest frame, NULL if empty
+    uint64_t* front()
+    {
+        auto tail = _tail.load(memory_order_relaxed);
+        if ( tail == _head.load(memory_order_acquire) ) return NULL;
+        return &_buf[ ( tail % _nframes ) * _framewords ];
+    }
+    void pop() { _tail.store( _tail.load(memory_order_relaxed) + 1, memory_order_release ); }
+    // For the producer: true once the consumer popped every frame
+    bool drained() { return _tail.load(memory_order_acquire) == _head.load(memory_order_relaxed); }
+    FrameRing(size_t framewords, size_t nframes) :
+        _buf( framewords * nframes ), _framewords(framewords), _nframes(nframes) {}
+};
+
 class Net : public HexUtils
 {
 protected:
     const string _name;
     const t_dir _dir;
 public:
-    static inline SpiceIfBase *_spiceif;
+    // The instance the net belongs to, taken at construction from the one last bound
+    // on the creating thread (see SpiceIf::bind)
+    static inline thread_local SpiceIfBase *_curspiceif;
+    static inline thread_local WatchTable *_curtable;
+    SpiceIfBase * const _spiceif;
+    WatchTable * const _table;
     virtual void sendPortStr() { _spiceif->sendCircCmd( string("+") + _name ); }
     string name() { return _name; }
-    virtual bool update(pvecvaluesall)=0;
+    SpiceIfBase *owner() { return _spiceif; }
     virtual void activate(t_vecid&)=0;
-    virtual void report()=0;
+    virtual void print(ostream&)=0;
+    void report()
+    {
+        print(cout);
+        cout.flush();
+    }
+    // For binary traces: number of bits and their LSB first packing into bytes
+    virtual int width()=0;
+    virtual void pack(uint8_t*)=0;
+    // WatchTable slots of the net's bits
+    virtual void slots(vector<int>&)=0;
+    virtual void scalars(vector<ScalarNet*>&)=0;
     virtual void set(unsigned long val)=0;
     virtual void set(string val)=0;
     virtual void save() { _spiceif->save(_name); }
@@ -205,156 +537,67 @@ public:
         if ( isInput() ) _spiceif->sendCircCmd(
             string("V") + _name + " " + _name + " 0 0 external");
     }
-    Net(string name, t_dir dir) : _name(name), _dir(dir) {}
+    Net(string name, t_dir dir) : _name(name), _dir(dir), _spiceif(_curspiceif), _table(_curtable) {}
+    virtual ~Net() {}
 };
 
 // NOTE: We tried using ngGet_Vec_Info to get pointers to vector infor or its real value array
 // However this information is not stable, despite the claim in the user manual rendering this
 // API almost useless. We have to unfortunately build a map on every Init callback and do activation
+// The values themselves live in the WatchTable, a ScalarNet is a view on its slot.
 class ScalarNet : public Net
 {
-    bool _logicval;
-    bool _isset = false;
-    int _vecid;
-protected:
-    double _realval;
-    bool _isactivated = false;
+    const int _slot;
+    int _vsrcid = -1;
 public:
-    unsigned long to_ulong() { return _logicval ? 1 : 0; }
+    int slot() { return _slot; }
+    int vsrcid() { return _vsrcid; }
+    void setVsrc()
+    {
+        if ( not isInput() or _spiceif->sendStimulus(_name) ) return;
+        Net::setVsrc();
+        _vsrcid = _spiceif->addVsrc(this);
+    }
+    unsigned long to_ulong() { return logicval() ? 1 : 0; }
     void set(unsigned long val)
     {
         if ( not isInput() ) return;
-        _logicval = val;
-        _realval = val ? vdd : 0;
-        _isset = true;
+        _table->set( _slot, val ? vdd : 0 );
     }
     void set(string val)
     {
         unsigned long ival = val[0] == '0' ? 0 : 1;
         set(ival);
     }
-    bool logicval() { return _logicval; }
-    double realval() { return _realval; }
-    void report()
-    {
-        if ( _isactivated )
-            cout << _name << "=" << _logicval << endl;
-    }
-    bool update(pvecvaluesall vecs)
+    bool logicval() { return _table->logicval(_slot); }
+    double realval() { return _table->realval(_slot); }
+    bool isActivated() { return _table->isActive(_slot); }
+    void print(ostream& os)
     {
-        bool changed = false;
-        if ( _isactivated )
-        {
-            if ( _vecid >= vecs->veccount )
-            {
-                cout << "In watch " << _name
-                << " _vecid=" << _vecid
-                << " veccount=" << vecs->veccount
-                << " exiting..." << endl;
-                exit(1);
-            }
-            _realval = vecs->vecsa[ _vecid ]->creal;
-            bool logicval = _realval > logicthresh;
-            changed = not _isset or logicval != _logicval;
-            _logicval = logicval;
-            _isset = true;
-        }
-        return changed;
+        if ( isActivated() )
+            os << _name << "=" << logicval() << "\n";
     }
+    int width() { return 1; }
+    void pack(uint8_t *dest) { dest[0] = logicval(); }
+    void slots(vector<int>& v) { v.push_back(_slot); }
+    void scalars(vector<ScalarNet*>& v) { v.push_back(this); }
     void activate(t_vecid& vecid)
     {
         auto it = vecid.find(_name);
         if ( it == vecid.end() )
             cout << "Unknown watch ignored: " << _name << endl;
-        else
-        {
-            _vecid = it->second;
-            _isactivated = true;
-            _isset = false;
-        }
+        else _table->bind( _slot, it->second );
     }
-    ScalarNet(string name, t_dir dir) : Net(name,dir) {}
+    // watched = false keeps the net out of change detection (e.g. time)
+    ScalarNet(string name, t_dir dir, bool watched = true) :
+        Net(name,dir), _slot( _table->addSlot(watched) ) {}
 };
 
 template <int sz> class VectorNet : public Net
 {
     vector<ScalarNet*> _nets {sz};
-    bitset<sz> _bits;
-    template<typename T> void _set(T val)
-    {
-        if ( not isInput() ) return;
-        _bits = bitset<sz>(val);
-        for(int i=0; i<sz; i++) _nets[i]->set(_bits[i]);
-    }
-    void hex2bin(const string &src, char *dest)
-    {
-        int di = sz - 1;
-        // src length already validated by caller
-        for( int si = src.length() - 1; di >= 0; si-- )
-        {
-            auto srcchar = src[si];
-            string nib;
-            switch ( srcchar )
-            {
-                case '0' :
-                    nib = "0000";
-                    break;
-                case '1' :
-                    nib = "0001";
-                    break;
-                case '2' :
-                    nib = "0010";
-                    break;
-                case '3' :
-                    nib = "0011";
-                    break;
-                case '4' :
-                    nib = "0100";
-                    break;
-                case '5' :
-                    nib = "0101";
-                    break;
-                case '6' :
-                    nib = "0110";
-                    break;
-                case '7' :
-                    nib = "0111";
-                    break;
-                case '8' :
-                    nib = "1000";
-                    break;
-                case '9' :
-                    nib = "1001";
-                    break;
-                case 'a' : case 'A':
-                    nib = "1010";
-                    break;
-                case 'b' : case 'B':
-                    nib = "1011";
-                    break;
-                case 'c' : case 'C':
-                    nib = "1100";
-                    break;
-                case 'd' : case 'D':
-                    nib = "1101";
-                    break;
-                case 'e' : case 'E':
-                    nib = "1110";
-                    break;
-                case 'f' : case 'F':
-                    nib = "1111";
-                    break;
-                default:
-                    cout << "Invalid character in hex string " << srcchar << endl;
-                    exit(1);
-            }
-            for( int ni = 3; ni >= 0 and di >= 0; ni-- )
-            {
-                dest[di] = nib[ni];
-                di--;
-            }
-        }
-    }
+    // subnets are created together and hence occupy consecutive slots
+    bitset<sz> bits() { return _table->bits<sz>( _nets[0]->slot() ); }
     bool spiceCompare( ScalarNet *a, ScalarNet *b )
     {
         auto an = a->name();
@@ -364,16 +607,37 @@ template <int sz> class VectorNet : public Net
         }
         return an < bn; // Otherwise, use lexicographical order
     }
-    string hexstr() { return bitset2hexstr<sz>(_bits); }
 public:
     vector<ScalarNet*>& subnets() { return _nets; }
-    unsigned long to_ulong() { return _bits.to_ulong(); }
-    void set(unsigned long val) { _set(val); }
+    unsigned long to_ulong() { return bits().to_ulong(); }
+    // Value as (sz+63)/64 words, LSB first
+    void getWords(uint64_t *words)
+    {
+        auto slot = _nets[0]->slot();
+        for(int wi=0; wi * 64 < sz; wi++)
+            words[wi] = _table->extract( slot + wi * 64, min( 64, sz - wi * 64 ) );
+    }
+    void setWords(const uint64_t *words)
+    {
+        if ( not isInput() ) return;
+        auto slot = _nets[0]->slot();
+        for(int wi=0; wi * 64 < sz; wi++)
+            _table->setWord( slot + wi * 64, min( 64, sz - wi * 64 ), words[wi], vdd );
+    }
+    WideWord<sz> value()
+    {
+        WideWord<sz> val;
+        getWords(val.w);
+        return val;
+    }
+    void set(const WideWord<sz>& val) { setWords(val.w); }
+    bool operator==(const WideWord<sz>& val) { return value() == val; }
+    bool operator!=(const WideWord<sz>& val) { return value() != val; }
+    void set(unsigned long val) { set( WideWord<sz>(val) ); }
     void set(string val)
     {
-        auto carr = val.c_str();
-        char barr[sz+1] = "";
-        switch ( *carr ) {
+        WideWord<sz> word;
+        switch ( val[0] ) {
             case 'b' :
                 if ( val.length() != sz + 1 )
                 {
@@ -381,24 +645,32 @@ public:
                         << " Got " << val.length() << endl;
                     exit(1);
                 }
-                _set(carr+1);
+                if ( not binstr2words( val.data() + 1, sz, word.w, sz ) )
+                {
+                    cout << "Invalid character in binary string " << val << endl;
+                    exit(1);
+                }
                 break;
             case 'x' : {
                 int explength = hexStrlen(sz) + 1; // 1 character extra for leading 'x'
-                if ( val.length() != explength )
+                if ( (int) val.length() != explength )
                 {
                     cout << "VectorNet: hex bitset of incorect size received. Expect " << explength
                         << " Got " << val.length() << endl;
                     exit(1);
                 }
-                hex2bin(val,barr);
-                _set(barr);
+                if ( not hexstr2words( val.data() + 1, explength - 1, word.w, sz ) )
+                {
+                    cout << "Invalid character in hex string " << val << endl;
+                    exit(1);
+                }
                 break;
                 }
             default:
                 cout << "VectorNet: bitset initialization string should start with b or x" << endl;
                 exit(1);
         }
+        set(word);
     }
     void sendPortStr()
     {
@@ -412,14 +684,23 @@ public:
     void save() { for(auto n:_nets) n->save(); }
     void activate(t_vecid& vecid) { for(auto n:_nets) n->activate(vecid); }
     void setVsrc() { for(auto n:_nets) n->setVsrc(); }
-    void report() { cout << _name.c_str() << "=" << hexstr() << endl; }
-    bool update(pvecvaluesall vecs)
+    void print(ostream& os)
     {
-        bool changed = false;
-        for(auto n:_nets)
-            if ( n->update(vecs) ) changed = true;
-        for(int i=0; i<sz; i++) _bits[i] = _nets[i]->logicval();
-        return changed;
+        uint64_t words[ WideWord<sz>::nwords ];
+        char hex[ ( sz + 3 ) / 4 ];
+        getWords(words);
+        words2hexstr( words, sz, hex );
+        os << _name << "=";
+        os.write( hex, sizeof(hex) ) << "\n";
+    }
+    int width() { return sz; }
+    void slots(vector<int>& v) { for(auto n:_nets) n->slots(v); }
+    void scalars(vector<ScalarNet*>& v) { v.insert( v.end(), _nets.begin(), _nets.end() ); }
+    void pack(uint8_t *dest)
+    {
+        uint64_t words[ WideWord<sz>::nwords ];
+        getWords(words);
+        for(int i=0; i<( sz + 7 ) / 8; i++) dest[i] = words[ i / 8 ] >> ( ( i % 8 ) * 8 );
     }
     VectorNet(string name, t_dir dir) : Net(name,dir)
     {
@@ -429,33 +710,391 @@ public:
     ~VectorNet() { for(auto n:_nets) delete n; }
 };
 
-class TimeNet : public ScalarNet
+class TimeNet final : public ScalarNet
 {
 public:
     void set(unsigned long val) {}
-    void report()
+    void print(ostream& os)
     {
-        if ( _isactivated )
-            cout << _name << "=" << _realval << endl;
+        if ( isActivated() )
+            os << _name << "=" << realval() << "\n";
     }
-    bool update(pvecvaluesall vecs)
+    // time is carried by the trace records themselves
+    int width() { return 0; }
+    TimeNet() : ScalarNet("time",OUT,false) {}
+};
+
+// Input voltages over time for open loop runs: per scalar input net the times at
+// which it changes and its new value. SpiceIf::openLoop compiles it into PWL
+// sources, so that ngspice runs without calling back for those inputs. It is
+// recorded from a run by SpiceIf::recordStimulus, or written with set(), and kept
+// as text lines "time net voltage".
+class StimSchedule
+{
+public:
+    typedef struct { double t; double v; } t_point;
+    map<string,vector<t_point>> nets;
+    // Changes of a net are to be added in time order
+    void add(string net, double t, double v)
+    {
+        auto& pts = nets[net];
+        if ( pts.empty() or pts.back().v != v ) pts.push_back( { t, v } );
+    }
+    // Same values as net->set(val) would give, which is done to obtain them
+    template <typename T> void set(double t, Net *net, T val)
+    {
+        if ( not net->isInput() )
+        {
+            cout << "StimSchedule: " << net->name() << " is not an input" << endl;
+            exit(1);
+        }
+        net->set(val);
+        vector<ScalarNet*> bits;
+        net->scalars(bits);
+        for(auto b:bits) add( b->name(), t, b->realval() );
+    }
+    bool save(string flnm)
+    {
+        ofstream ofs(flnm);
+        if ( not ofs ) return false;
+        ofs.precision(17);
+        for(auto& n:nets)
+            for(auto& p:n.second) ofs << p.t << " " << n.first << " " << p.v << "\n";
+        return bool(ofs);
+    }
+    bool load(string flnm)
+    {
+        ifstream ifs(flnm);
+        if ( not ifs ) return false;
+        nets.clear();
+        string line;
+        while ( getline(ifs, line) )
+        {
+            istringstream ls(line);
+            double t, v;
+            string net;
+            if ( line.empty() or line[0] == '*' ) continue;
+            if ( not ( ls >> t >> net >> v ) ) return false;
+            add(net, t, v);
+        }
+        return true;
+    }
+    // Lines of the source for net, each change ramped over rise or fall seconds.
+    // A change during the ramp of the previous one starts where that ramp ends.
+    list<string> pwl(string net, double rise, double fall)
+    {
+        list<string> lines;
+        auto it = nets.find(net);
+        if ( it == nets.end() ) return lines;
+        auto& pts = it->second;
+        vector<double> tv;
+        double prev = pts[0].t == 0 ? pts[0].v : 0;
+        double last = 0;
+        tv.insert( tv.end(), { 0, prev } );
+        for(auto& p:pts)
+        {
+            if ( p.v == prev ) continue;
+            auto start = max( p.t, last );
+            if ( start > last ) tv.insert( tv.end(), { start, prev } );
+            last = start + ( p.v > prev ? rise : fall );
+            tv.insert( tv.end(), { last, p.v } );
+            prev = p.v;
+        }
+        lines.push_back( string("V") + net + " " + net + " 0 pwl(" );
+        char buf[64];
+        string line = "+";
+        for(size_t i=0; i<tv.size(); i+=2)
+        {
+            snprintf( buf, sizeof(buf), " %.15g %.15g", tv[i], tv[i+1] );
+            line += buf;
+            if ( line.size() > 200 )
+            {
+                lines.push_back(line);
+                line = "+";
+            }
+        }
+        lines.push_back( line + " )" );
+        return lines;
+    }
+};
+
+// Timer queue on simulation time and edge subscriptions on WatchTable slots. Per
+// step only the changed slots are visited, so steps where nothing changed and no
+// timer is due cost a couple of compares.
+class Scheduler
+{
+    typedef struct { double t; unsigned long seq; t_action fn; } t_timer;
+    struct Later
+    {
+        bool operator()(const t_timer& a, const t_timer& b)
+        {
+            return a.t > b.t or ( a.t == b.t and a.seq > b.seq );
+        }
+    };
+    typedef struct { t_edge edge; t_action fn; unsigned long laststep; bool once; vector<int> slots; } t_sub;
+    priority_queue<t_timer, vector<t_timer>, Later> _timers;
+    unsigned long _timerseq = 0;
+    deque<t_sub> _subs;             // a deque, as actions running from it may subscribe
+    vector<int> _freesubs;          // ids of finished once subscriptions, for reuse
+    vector<vector<int>> _slotsubs;  // slot -> indices in _subs
+    vector<int> _due;
+    int subscribe(const vector<int>& slots, t_edge edge, t_action fn, bool once)
+    {
+        int id;
+        if ( _freesubs.empty() )
+        {
+            id = _subs.size();
+            _subs.push_back( { edge, fn, 0, once, slots } );
+        }
+        else
+        {
+            id = _freesubs.back();
+            _freesubs.pop_back();
+            _subs[id] = { edge, fn, 0, once, slots };
+        }
+        for(auto slot:slots)
+        {
+            if ( slot >= (int) _slotsubs.size() ) _slotsubs.resize( slot + 1 );
+            _slotsubs[slot].push_back(id);
+        }
+        return id;
+    }
+    // Called after a once subscription ran, not from within it
+    void release(int id)
+    {
+        auto& sub = _subs[id];
+        for(auto slot:sub.slots)
+        {
+            auto& ids = _slotsubs[slot];
+            ids.erase( find( ids.begin(), ids.end(), id ) );
+        }
+        sub.fn = nullptr;
+        _freesubs.push_back(id);
+    }
+    unsigned long _step = 0;
+public:
+    // fn runs once, on the first step whose time is >= t
+    void at(double t, t_action fn) { _timers.push( { t, _timerseq++, fn } ); }
+    // fn runs on every step where the given slots change as per edge. Returns an id for off.
+    int on(const vector<int>& slots, t_edge edge, t_action fn) { return subscribe(slots, edge, fn, false); }
+    // fn runs on the first such step only, e.g. to resume a waiting coroutine
+    void once(const vector<int>& slots, t_edge edge, t_action fn) { subscribe(slots, edge, fn, true); }
+    void off(int id) { _subs[id].fn = nullptr; }
+    void clearTimers() { _timers = decltype(_timers)(); }
+    void clear()
+    {
+        clearTimers();
+        _subs.clear();
+        _freesubs.clear();
+        _slotsubs.clear();
+    }
+    // initial is the first step of an analysis, where there is nothing to compare
+    // with and hence no edges
+    bool run(WatchTable& table, double now, bool changed, bool initial)
+    {
+        bool inputschanged = false;
+        _step++;
+        if ( changed and not initial and not _slotsubs.empty() )
+        {
+            _due.clear();
+            auto& diffs = table.diffs();
+            for(size_t wi=0; wi<diffs.size(); wi++)
+                for(auto word = diffs[wi]; word; word &= word - 1)
+                {
+                    size_t slot = wi * 64 + __builtin_ctzll(word);
+                    if ( slot >= _slotsubs.size() ) break;
+                    for(auto id:_slotsubs[slot])
+                    {
+                        auto& sub = _subs[id];
+                        if ( not sub.fn or sub.laststep == _step ) continue;
+                        if ( sub.edge == RISING and not table.logicval(slot) ) continue;
+                        if ( sub.edge == FALLING and table.logicval(slot) ) continue;
+                        sub.laststep = _step;
+                        _due.push_back(id);
+                    }
+                }
+            // actions may subscribe more, hence not called while iterating
+            for(auto id:_due)
+            {
+                if ( _subs[id].fn() ) inputschanged = true;
+                if ( _subs[id].once ) release(id);
+            }
+        }
+        while ( not _timers.empty() and _timers.top().t <= now )
+        {
+            auto fn = _timers.top().fn;
+            _timers.pop();
+            if ( fn() ) inputschanged = true;
+        }
+        return inputschanged;
+    }
+};
+
+// Receives SpiceIf's trace: the per step timestep and dumps of all nets, either
+// because their state changed (sep '=') or the event handler changed inputs (sep '~')
+class TraceSink
+{
+public:
+    virtual void begin(map<string,Net*>& nets) {}
+    virtual void timestep(int vecindex) {}
+    virtual void dump(map<string,Net*>& nets, char sep, int vecindex, double time) {}
+    virtual void flush() {}
+    virtual ~TraceSink() {}
+};
+
+class NullTraceSink : public TraceSink {};
+
+// The classic text format, same as what report() prints
+class TextTraceSink : public TraceSink
+{
+    TraceWriter& _writer;
+    TraceBuf _buf;
+    ostream _os {&_buf};
+    void push()
+    {
+        _writer.write(_buf);
+        _buf.clear();
+    }
+public:
+    void timestep(int vecindex)
     {
-        ScalarNet::update(vecs);
-        return false;
+        _os << "timestep=" << vecindex << "\n";
+        push();
     }
-    TimeNet() : ScalarNet("time",OUT) {}
+    void dump(map<string,Net*>& nets, char sep, int vecindex, double time)
+    {
+        for(auto& n:nets) n.second->print(_os);
+        char rule[20];
+        memset( rule, sep, 19 );
+        rule[19] = '\n';
+        _os.write( rule, sizeof(rule) );
+        push();
+    }
+    void flush() { _writer.flush(); }
+    TextTraceSink(TraceWriter& writer) : _writer(writer) {}
+};
+
+// Compact change log. Header: "SPTRACE1", u32 net count, per net u32 width, u32
+// name length, name. Records: 'T' i32 vecindex for a timestep, or sep ('=' / '~')
+// i32 vecindex, f64 time, u32 count followed by count entries of u32 net id and
+// the net's (width+7)/8 bytes, only for nets that changed since the last dump.
+class BinaryTraceSink : public TraceSink
+{
+    TraceWriter& _writer;
+    string _rec;
+    vector<Net*> _nets;
+    vector<vector<uint8_t>> _lastvals;
+    vector<uint8_t> _val;
+    bool _begun = false;
+    template <typename T> void put(T val) { _rec.append( (char*) &val, sizeof(T) ); }
+public:
+    void begin(map<string,Net*>& nets)
+    {
+        if ( _begun ) return;
+        _begun = true;
+        _rec = "SPTRACE1";
+        for(auto n:nets)
+            if ( n.second->width() ) _nets.push_back(n.second);
+        put<uint32_t>( _nets.size() );
+        for(auto n:_nets)
+        {
+            put<uint32_t>( n->width() );
+            put<uint32_t>( n->name().size() );
+            _rec += n->name();
+            _lastvals.emplace_back();
+        }
+        _writer.write(_rec);
+    }
+    void timestep(int vecindex)
+    {
+        _rec = 'T';
+        put<int32_t>(vecindex);
+        _writer.write(_rec);
+    }
+    void dump(map<string,Net*>& nets, char sep, int vecindex, double time)
+    {
+        _rec = sep;
+        put<int32_t>(vecindex);
+        put<double>(time);
+        auto countpos = _rec.size();
+        put<uint32_t>(0);
+        uint32_t count = 0;
+        for(uint32_t id=0; id<_nets.size(); id++)
+        {
+            _val.resize( ( _nets[id]->width() + 7 ) / 8 );
+            _nets[id]->pack( _val.data() );
+            if ( _val == _lastvals[id] ) continue;
+            _lastvals[id] = _val;
+            put<uint32_t>(id);
+            _rec.append( (char*) _val.data(), _val.size() );
+            count++;
+        }
+        _rec.replace( countpos, sizeof(count), (char*) &count, sizeof(count) );
+        _writer.write(_rec);
+    }
+    void flush() { _writer.flush(); }
+    BinaryTraceSink(TraceWriter& writer) : _writer(writer) {}
 };
 
 class SpiceIf : public SpiceIfBase
 {
     const bool _saveall;
-    static inline int _id = 0; // Needed for ngSpice_Init_Sync
+    bool _savenets;         // .save each net's vectors, as ngspice then saves only those named
+    set<string> _saved;
+    int _id = 0; // Needed for ngSpice_Init_Sync
     TimeNet *_timenet;
     map<string,Net*> _nets;
+    list<Net*> _ownednets; // those created by getNet, not the ones added by addNets
     map<string,Net*> _subInpnets; // Only for external input subnets (for fnGetVSRCData)
+    vector<ScalarNet*> _vsrcnets; // indexed by vsrcid
+    // ngspice asks for the sources in the same order on every iteration, passing
+    // the same name pointers. The cache keeps them in that order so that the entry
+    // at the cursor is nearly always the one asked for.
+    typedef struct { char *name; int vsrcid; } t_vsrccacheent;
+    vector<t_vsrccacheent> _vsrccache;
+    size_t _vsrccursor = 0;
+    unsigned long _vsrchits = 0;
+    unsigned long _vsrcmisses = 0;
+    StimSchedule *_stim = NULL;     // see openLoop
+    double _stimrise, _stimfall;
+    StimSchedule *_record = NULL;   // see recordStimulus
     t_vecid _vecid;
+    size_t _nactivated = 0; // size of _nets when _vecid was last activated
+    WatchTable _table;
+    Scheduler _scheduler;
     EventHandler *_eh = NULL;
-    int fnGetVSRCData(double* retV, char* name, void* p)
+    TraceWriter *_tracewriter = NULL; // owned, backs the default sink
+    TraceSink *_defaultsink = NULL;
+    TraceSink *_sink = NULL;
+    bool _tracetimesteps = true;
+    RawStreamWriter *_rawstream = NULL; // see streamRaw
+    list<string> _rawvecs;
+    vector<int> _rawvecids;
+    vector<double> _rawrow;
+    // Background mode (runBg): ngspice's thread only digitizes steps into frames of
+    // [vecindex, initial, time, bits words, diff words], the rest runs on a consumer thread.
+    // Input values go the other way through an atomically swapped table.
+    bool _bg = false;
+    atomic<bool> _bgdone {false};
+    t_backpressure _backpressure = BP_BLOCK;
+    FrameRing *_frames = NULL;
+    vector<double> _bgreals;        // solver side copies of the WatchTable state
+    vector<uint64_t> _bgbits;
+    vector<uint64_t> _bgdiff;
+    vector<uint64_t> _bgpending;    // changes not yet delivered in a frame
+    unsigned long _coalesced = 0;
+    shared_ptr<const vector<double>> _vsrcpub;  // published by the consumer
+    shared_ptr<const vector<double>> _vsrcsnap; // solver's snapshot of it
+#ifdef SPICEPERF
+    SpicePerf _perf;
+    void perfRunDone(chrono::steady_clock::time_point start)
+    {
+        _perf.wallsecs += chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+        _perf.simtime += getSimuTime();
+    }
+#endif
+    // Slow path, once per source: lookup by name
+    int resolveVsrc(char *name)
     {
         ScalarNet *net = NULL;
         auto it = _subInpnets.find(&name[1]);
@@ -465,29 +1104,63 @@ class SpiceIf : public SpiceIfBase
             it = _nets.find(&name[1]);
             if ( it != _nets.end() ) net = (ScalarNet*) it->second;
         }
-        if ( net == NULL )
+        if ( net == NULL or net->vsrcid() < 0 )
         {
             cout << "fnGetVSRCData could not find net " << name << endl;
             exit(1);
         }
-        else
+        return net->vsrcid();
+    }
+    int vsrcLookup(char *name)
+    {
+        auto n = _vsrccache.size();
+        if ( n and _vsrccache[_vsrccursor].name == name )
         {
-            *retV = net->realval();
+            _vsrchits++;
+            auto vsrcid = _vsrccache[_vsrccursor].vsrcid;
+            _vsrccursor = _vsrccursor + 1 == n ? 0 : _vsrccursor + 1;
+            return vsrcid;
+        }
+        _vsrcmisses++;
+        for(size_t i=0; i<n; i++)
+            if ( _vsrccache[i].name == name )
+            {
+                _vsrccursor = i + 1 == n ? 0 : i + 1;
+                return _vsrccache[i].vsrcid;
+            }
+        _vsrccache.push_back( { name, resolveVsrc(name) } );
+        _vsrccursor = 0;
+        return _vsrccache.back().vsrcid;
+    }
+    void addSubInpnets(Net*) {}
+    template<int sz> void addSubInpnets(VectorNet<sz> *net)
+    {
+        if ( net->isInput() )
+            for( auto sn : net->subnets() )
+                _subInpnets.emplace( sn->name(), sn );
+    }
+    int fnGetVSRCData(double* retV, double time, char* name, void* p)
+    {
+#ifdef SPICEPERF
+        PerfTimer perftimer(_perf.getVsrc);
+        _perf.vsrcTime(time);
+#endif
+        auto vsrcid = vsrcLookup(name);
+        *retV = _bg ? (*_vsrcsnap)[vsrcid] : _vsrcnets[vsrcid]->realval();
 #ifdef SPICEDBG
-            cout << "fnGetVSRCData returning " << name << " = " << *retV << endl;
+        cout << "fnGetVSRCData returning " << name << " = " << *retV << endl;
 #endif
-        }
         return 0;
     }
     void initSimu()
     {
         GetVSRCData *vsrcdat = [](double* retV, double time, char* name, int id, void* p)
-            { return ((SpiceIf*)p)->fnGetVSRCData(retV, name, p); };
+            { return ((SpiceIf*)p)->fnGetVSRCData(retV, time, name, p); };
         GetISRCData *isrcdat = NULL;
         GetSyncData *syncdat = NULL;
         int *ident = &_id;
         void *userData = this;
-        ngSpice_Init_Sync(vsrcdat, isrcdat, syncdat, ident, userData);
+        _ng.initSync(vsrcdat, isrcdat, syncdat, ident, userData);
 
         addTimeWatch();
     }
@@ -501,28 +1174,159 @@ class SpiceIf : public SpiceIfBase
             << endl;
         cout.flush();
 #endif
-        bool changed = false;
-        for(auto n:_nets)
-            if ( n.second->update(vecs) ) changed = true;
-        cout << "timestep=" << vecs->vecindex << endl;
+#ifdef SPICEPERF
+        PerfTimer perftimer(_perf.sendData);
+#endif
+        if ( _rawstream ) streamStep(vecs);
+        if ( _bg ) pushFrame(vecs);
+        else
+        {
+            bool initial = not _table.primed();
+            step( vecs->vecindex, _table.update(vecs), initial );
+        }
+        return 0;
+    }
+    void streamStep(pvecvaluesall vecs)
+    {
+        auto vecsa = vecs->vecsa;
+        for(size_t k=0; k<_rawvecids.size(); k++)
+        {
+            if ( _rawvecids[k] >= vecs->veccount ) return;
+            _rawrow[k] = vecsa[ _rawvecids[k] ]->creal;
+        }
+        _rawstream->append( _rawrow.data() );
+    }
+    // Resolves the streamed vectors, time first, all vectors if none were named
+    void beginStream(pvecinfoall vecs)
+    {
+        vector<string> names {"time"};
+        if ( _rawvecs.empty() )
+        {
+            for(int i=0; i<vecs->veccount; i++)
+                if ( string( vecs->vecs[i]->vecname ) != "time" )
+                    names.push_back( vecs->vecs[i]->vecname );
+        }
+        else names.insert( names.end(), _rawvecs.begin(), _rawvecs.end() );
+        _rawvecids.clear();
+        for(auto& n:names)
+        {
+            auto it = _vecid.find(n);
+            if ( it == _vecid.end() )
+            {
+                cout << "SpiceIf::streamRaw: no vector named " << n << endl;
+                exit(1);
+            }
+            _rawvecids.push_back( it->second );
+        }
+        _rawrow.resize( names.size() );
+        if ( not _rawstream->begun() ) _rawstream->begin(names);
+    }
+    void endStream()
+    {
+        if ( _rawstream == NULL ) return;
+        _rawstream->close();
+        delete _rawstream;
+        _rawstream = NULL;
+    }
+    // Trace and event handling of a step, once the WatchTable holds its values
+    void step(int vecindex, bool changed, bool initial)
+    {
+        if ( _tracetimesteps ) _sink->timestep(vecindex);
 #ifndef SPICEDBG
         if ( changed )
 #endif
+            _sink->dump( _nets, '=', vecindex, getSimuTime() );
+        bool inputschanged;
         {
-            for(auto n:_nets) n.second->report();
-            cout << "===================" << endl;
+#ifdef SPICEPERF
+            PerfTimer perftimer(_perf.handleEvent);
+#endif
+            inputschanged = _scheduler.run( _table, getSimuTime(), changed, initial );
+            // for real time based events such as reset, handleEvent has to be called
+            // even if state didn't change, so we call it and pass 'changed' to it.
+            // Time based actions are better scheduled with at() though.
+            if ( _eh and _eh->handleEvent(changed) ) inputschanged = true;
         }
-        // for real time based events such as reset, handleEvent has to be called
-        // even if state didn't change, so we call it and pass 'changed' to it
-        if ( _eh )
+        if ( inputschanged )
+            _sink->dump( _nets, '~', vecindex, getSimuTime() );
+        if ( _record and ( inputschanged or initial ) )
+            for(auto n:_vsrcnets) _record->add( n->name(), getSimuTime(), n->logicval() ? vdd : 0 );
+    }
+    void pushFrame(pvecvaluesall vecs)
+    {
+        auto nw = _table.words();
+        bool initial = not _table.primed();
+        _table.digitize( vecs, _bgreals.data(), _bgbits.data(), _bgbits.data(), _bgdiff.data() );
+        for(int wi=0; wi<nw; wi++) _bgpending[wi] |= _bgdiff[wi];
+        auto frame = _frames->claim();
+        while ( frame == NULL and _backpressure == BP_BLOCK )
         {
-            auto ehchanged = _eh->handleEvent(changed);
-            if ( ehchanged )
+            this_thread::yield();
+            frame = _frames->claim();
+        }
+        if ( frame == NULL )
+        {
+            _coalesced++;
+            return;
+        }
+        frame[0] = vecs->vecindex;
+        frame[1] = initial;
+        double time = _bgreals[ _timenet->slot() ];
+        memcpy( &frame[2], &time, sizeof(time) );
+        copy( _bgbits.begin(), _bgbits.end(), &frame[3] );
+        copy( _bgpending.begin(), _bgpending.end(), &frame[3+nw] );
+        fill( _bgpending.begin(), _bgpending.end(), 0 );
+        _frames->publish();
+        // inputs published by the consumer so far apply from the next step on
+        _vsrcsnap = atomic_load(&_vsrcpub);
+    }
+    void consumeFrames()
+    {
+        auto nw = _table.words();
+        int idle = 0;
+        while ( true )
+        {
+            auto frame = _frames->front();
+            if ( frame == NULL )
             {
-                for(auto n:_nets) n.second->report();
-                cout << "~~~~~~~~~~~~~~~~~~~" << endl;
+                if ( _bgdone.load(memory_order_acquire) and _frames->front() == NULL ) break;
+                // spins briefly as frames come in bursts, then stops burning a core
+                if ( ++idle < 64 ) this_thread::yield();
+                else this_thread::sleep_for( chrono::microseconds(50) );
+                continue;
             }
+            idle = 0;
+            double time;
+            memcpy( &time, &frame[2], sizeof(time) );
+            _table.load( &frame[3], &frame[3+nw] );
+            _table.set( _timenet->slot(), time );
+            bool changed = false;
+            for(int wi=0; wi<nw; wi++)
+                if ( frame[3+nw+wi] ) changed = true;
+            step( frame[0], changed, frame[1] );
+            publishVsrc();
+            _frames->pop(); // last, see fnSendInitData
         }
+    }
+    // Publishes the input values set on the consumer side, if they changed
+    void publishVsrc()
+    {
+        auto cur = atomic_load(&_vsrcpub);
+        auto n = _vsrcnets.size();
+        if ( cur and cur->size() == n )
+        {
+            size_t i = 0;
+            while ( i < n and (*cur)[i] == _vsrcnets[i]->realval() ) i++;
+            if ( i == n ) return;
+        }
+        auto vals = make_shared<vector<double>>(n);
+        for(size_t i=0; i<n; i++) (*vals)[i] = _vsrcnets[i]->realval();
+        atomic_store( &_vsrcpub, shared_ptr<const vector<double>>(vals) );
+    }
+    int fnBGThreadRunning(NG_BOOL noBGThread)
+    {
+        SpiceIfBase::fnBGThreadRunning(noBGThread);
+        if ( noBGThread ) _bgdone.store(true, memory_order_release);
         return 0;
     }
     // Seen called e.g. on every .tran, e.g. .tran 1n, 20n means it will be invoked twice
@@ -537,48 +1341,155 @@ class SpiceIf : public SpiceIfBase
             << " veccount:" << vecs->veccount
             << endl;
 #endif
+        // In runBg this is on ngspice's thread, and a new analysis must wait for the
+        // consumer to be done with the frames of the last one before the table, the
+        // nets and the sink change under it
+        if ( _bg )
+            while ( not _frames->drained() ) this_thread::sleep_for( chrono::microseconds(50) );
+        t_vecid vecid;
         for(int i=0; i<vecs->veccount; i++)
         {
             auto vinfo = vecs->vecs[i];
-            _vecid[vinfo->vecname] = vinfo->number;
+            vecid[vinfo->vecname] = vinfo->number;
 #ifdef SPICEDBG
             cout << "vec " << vinfo->vecname << " = " << vinfo->number << endl;
 #endif
         }
-        for(auto n:_nets) n.second->activate(_vecid);
+        _vsrccache.clear(); // name pointers may not survive a new analysis
+        _vsrccursor = 0;
+        // Activation is kept if neither the vectors nor the nets changed since the last one
+        if ( vecid != _vecid or _nets.size() != _nactivated )
+        {
+            _vecid.swap(vecid);
+            _table.unbindAll();
+            for(auto n:_nets) n.second->activate(_vecid);
+            _table.compile();
+            _nactivated = _nets.size();
+        }
+        else _table.restart();
+        if ( _rawstream ) beginStream(vecs);
+        _sink->begin(_nets);
 #ifdef SPICEDBG
         cout.flush();
 #endif
         return 0;
     }
 public:
+    // Nets created on this thread from now on belong to this instance. The constructor
+    // and getNet do it; call it before creating a Nets group (spicenets.h) if another
+    // SpiceIf was created on the thread since.
+    void bind()
+    {
+        Net::_curspiceif = this;
+        Net::_curtable = &_table;
+    }
     template<int sz> Net* getNet(string name, t_dir dir)
     {
         auto it = _nets.find(name);
         if ( it == _nets.end() )
         {
+            bind();
             Net *net;
             if constexpr ( sz == 0 )
                 net = new ScalarNet(name,dir);
             else
             {
-                net = new VectorNet<sz>(name,dir);
-                if ( net->isInput() )
-                    for( auto sn : ((VectorNet<sz>*)net)->subnets() )
-                        _subInpnets.emplace( sn->name(), sn );
+                auto vnet = new VectorNet<sz>(name,dir);
+                addSubInpnets(vnet);
+                net = vnet;
             }
             _nets.emplace(name,net);
-            if ( not _saveall ) net->save();
+            _ownednets.push_back(net);
+            if ( _savenets ) net->save();
             return net;
         }
         else return it->second;
     }
+    // Registers the nets of a group (see spicenets.h), which stays owned by the caller
+    template <typename G> void addNets(G& group)
+    {
+        group.forEach( [this](auto& net)
+        {
+            if ( net.owner() != this )
+            {
+                cout << "SpiceIf::addNets: net " << net.name() << " was created for another SpiceIf" << endl;
+                exit(1);
+            }
+            if ( not _nets.emplace( net.name(), &net ).second )
+            {
+                cout << "SpiceIf::addNets: net " << net.name() << " already exists" << endl;
+                exit(1);
+            }
+            addSubInpnets(&net);
+            if ( _savenets ) net.save();
+        } );
+    }
     void setEventHandler(EventHandler *eh) { _eh = eh; }
+    // Runs fn once, on the first step at or after simulation time t
+    void at(double t, t_action fn) { _scheduler.at(t, fn); }
+    // Runs fn whenever net changes; RISING and FALLING apply to scalar nets only.
+    // Returns an id to pass to off.
+    int on(Net *net, t_edge edge, t_action fn)
+    {
+        if ( edge != CHANGE and net->width() != 1 )
+        {
+            cout << "SpiceIf::on: edges apply only to scalar nets, got " << net->name() << endl;
+            exit(1);
+        }
+        vector<int> slots;
+        net->slots(slots);
+        return _scheduler.on(slots, edge, fn);
+    }
+    void off(int id) { _scheduler.off(id); }
+    // Same as on, for the first such step only
+    void once(Net *net, t_edge edge, t_action fn)
+    {
+        if ( edge != CHANGE and net->width() != 1 )
+        {
+            cout << "SpiceIf::once: edges apply only to scalar nets, got " << net->name() << endl;
+            exit(1);
+        }
+        vector<int> slots;
+        net->slots(slots);
+        _scheduler.once(slots, edge, fn);
+    }
+    // Runs fn and tells whether it changed any input, for actions that cannot tell
+    // by themselves (e.g. a resumed coroutine, see spicecoro.h)
+    bool changesInputs(function<void()> fn)
+    {
+        auto before = _table.changes();
+        fn();
+        return _table.changes() != before;
+    }
+    // The sink is not owned. Pass NULL to go back to the text trace on stdout.
+    void setTraceSink(TraceSink *sink) { _sink = sink ? sink : _defaultsink; }
+    // Open loop mode: the inputs in sched, which stays owned by the caller, get PWL
+    // sources with the given rise and fall times in place of external ones when
+    // instantiate is called, so their set() calls have no effect on the circuit.
+    void openLoop(StimSchedule *sched, double rise = 1e-12, double fall = 1e-12)
+    {
+        _stim = sched;
+        _stimrise = rise;
+        _stimfall = fall;
+    }
+    bool sendStimulus(string name)
+    {
+        if ( _stim == NULL ) return false;
+        auto lines = _stim->pwl(name, _stimrise, _stimfall);
+        for(auto& l:lines) sendCircCmd(l);
+        return not lines.empty();
+    }
+    // Records the input values the testbench sets during the following runs into
+    // sched, for a later open loop run. NULL stops recording.
+    void recordStimulus(StimSchedule *sched) { _record = sched; }
+    // Set false to suppress the timestep= record on every step
+    void traceTimesteps(bool enable) { _tracetimesteps = enable; }
     double getSimuTime() { return _timenet->realval(); }
     void addTimeWatch()
     {
         _timenet = new TimeNet();
         _nets.emplace("time",_timenet);
+        _ownednets.push_back(_timenet);
     }
     // Check the sequence of ports in the generated circuit and maintain it
     // GND and Vdd are first two ports bound by default which must not be passed
@@ -592,28 +1503,133 @@ public:
         // (hence we don't do this in the constructor)
         for(auto p:ports) p->setVsrc();
     }
+    int addVsrc(ScalarNet *net)
+    {
+        _vsrcnets.push_back(net);
+        return _vsrcnets.size() - 1;
+    }
+    // fnGetVSRCData lookups served by the cursor vs. those that needed a search
+    unsigned long vsrcHits() { return _vsrchits; }
+    unsigned long vsrcMisses() { return _vsrcmisses; }
+    // Has ngspice keep the vector; once the circuit is loaded this applies from the next run
     void save(string name)
     {
-        string cmd = ".save ";
-        sendCircCmd( cmd + name );
+        if ( not _saved.insert(name).second ) return;
+        if ( _loaded ) sendCmd( "save " + name );
+        else sendCircCmd( ".save " + name );
     }
+    // The circuit stays loaded after a run. To run it again, e.g. with other
+    // stimuli, call restart, optionally tran for new parameters, then run.
     void run()
     {
-        end();
-        sendCmd("run");
+#ifdef SPICEPERF
+        auto perfstart = chrono::steady_clock::now();
+#endif
+        if ( not _loaded ) end();
+        sendCmd(_runcmd);
+        endStream();
+        _sink->flush();
+#ifdef SPICEPERF
+        perfRunDone(perfstart);
+#endif
     }
-    // Pass saveall = false if you want only the created nets' vectors to be saved, and not all
-    SpiceIf(char *initfile, bool saveall = true) : _saveall(saveall)
+    // Streams the named vectors (all if none) of the next run to a chunked raw
+    // file as the steps arrive, instead of writeraw dumping them at the end.
+    // SpiceDbg reads such files like ngspice's raw files. Named vectors are
+    // saved, and from then on ngspice keeps only them and the nets' vectors in
+    // memory for the run, even with saveall, which the later runs keep too.
+    void streamRaw(string flnm, list<string> vecs = {}, size_t chunkpoints = 1024)
     {
+        if ( flnm.empty() )
+        {
+            cout << "SpiceIf::streamRaw: no file name given" << endl;
+            exit(1);
+        }
+        endStream();
+        _rawvecs = vecs;
+        _rawstream = new RawStreamWriter(flnm, chunkpoints);
+        if ( vecs.empty() ) return;
+        for(auto& v:vecs) save(v);
+        if ( not _savenets )
+            for(auto& n:_nets) n.second->save();
+        _savenets = true;
+    }
+    // Prepares another run of the loaded circuit: inputs back to 0, scheduled
+    // actions dropped and eh as the event handler. The init file isn't sourced again.
+    // The plots of the previous runs are destroyed so that memory does not grow
+    // with the number of runs: call writeraw before restart to keep one.
+    void restart(EventHandler *eh = NULL)
+    {
+        sendCmd("destroy all");
+        _eh = eh;
+        _scheduler.clear();
+        for(auto n:_vsrcnets) _table.set( n->slot(), 0 );
+    }
+    // Like run, but ngspice runs in its background thread and only pushes
+    // digitized frames into a queue of nframes. Tracing and the event handler run
+    // on a consumer thread. Inputs the handler sets reach the simulator from the
+    // step after the frame being handled was produced. Only logic values and time
+    // are carried in frames, realval of other nets is not maintained in this mode.
+    void runBg(size_t nframes = 1024, t_backpressure backpressure = BP_BLOCK)
+    {
+#ifdef SPICEPERF
+        auto perfstart = chrono::steady_clock::now();
+#endif
+        if ( not _loaded ) end();
+        auto nw = _table.words();
+        _frames = new FrameRing( 3 + 2 * nw, nframes );
+        _backpressure = backpressure;
+        _bgreals.assign( nw * 64, 0 );
+        _bgbits.assign( nw, 0 );
+        _bgdiff.assign( nw, 0 );
+        _bgpending.assign( nw, 0 );
+        publishVsrc();
+        _vsrcsnap = atomic_load(&_vsrcpub);
+        _bgdone = false;
+        _bg = true;
+        thread consumer( [this]() { consumeFrames(); } );
+        // no background thread, hence no end notification, if the command failed
+        if ( sendCmd( "bg_" + _runcmd ) ) _bgdone.store(true, memory_order_release);
+        consumer.join(); // returns once the background thread ended and frames are drained
+        _bg = false;
+        delete _frames;
+        _frames = NULL;
+        endStream();
+        _sink->flush();
+#ifdef SPICEPERF
+        perfRunDone(perfstart);
+#endif
+    }
+    // Steps whose frame was folded into a later one under BP_COALESCE
+    unsigned long coalescedFrames() { return _coalesced; }
+    // Pass saveall = false if you want only the created nets' vectors to be saved, and not all.
+    // Pass the path of libngspice.so as libpath to run on a private copy of it, so that
+    // several SpiceIfs can simulate concurrently, e.g. one per thread.
+    SpiceIf(char *initfile, bool saveall = true, string libpath = "") :
+        SpiceIfBase(libpath), _saveall(saveall), _savenets(not saveall)
+    {
+        bind(); // must be before any net is created
+        _tracewriter = new TraceWriter();
+        _defaultsink = _sink = new TextTraceSink(*_tracewriter);
         initSimu();
         initComment();
         sourceFile(initfile);
         setVdd();
-        Net::_spiceif = this;
     }
+#ifdef SPICEPERF
+    // Printed, and written as json if perf().jsonfile is set, when SpiceIf is destroyed
+    SpicePerf& perf() { return _perf; }
+#endif
     ~SpiceIf()
     {
-        for( auto n:_nets ) delete n.second;
+#ifdef SPICEPERF
+        _perf.tracebytes = _tracewriter->bytes();
+        _perf.finish();
+#endif
+        endStream();
+        for( auto n:_ownednets ) delete n;
+        delete _defaultsink;
+        delete _tracewriter;
     }
 };
 
@@ -0,0 +1,191 @@
+#ifndef _SPICEMEAS_H
+#define _SPICEMEAS_H
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <cmath>
+#include <cstdint>
+#include <stdio.h>
+#include "spiceconf.h"
+#include "spiceraw.h"
+
+using namespace std;
+
+typedef enum { RISE, FALL, EITHER } t_measedge;
+
+// Count, min, max, mean and a histogram of bins binwidth (> 0) wide
+class MeasStats
+{
+    uint64_t _count = 0;
+    double _min = 0, _max = 0, _sum = 0;
+    double _binwidth;
+    map<int64_t,uint64_t> _bins;
+public:
+    void add(double v)
+    {
+        if ( _count == 0 or v < _min ) _min = v;
+        if ( _count == 0 or v > _max ) _max = v;
+        _count++;
+        _sum += v;
+        _bins[ (int64_t) floor( v / _binwidth + 1e-9 ) ]++; // values on a bin edge go up despite rounding
+    }
+    void clear()
+    {
+        _count = 0;
+        _min = _max = _sum = 0;
+        _bins.clear();
+    }
+    uint64_t count() { return _count; }
+    double min() { return _min; }
+    double max() { return _max; }
+    double mean() { return _count ? _sum / _count : 0; }
+    void print(ostream& os, string name)
+    {
+        char buf[256];
+        snprintf( buf, sizeof(buf), "%s count=%llu min=%g max=%g mean=%g\n",
+            name.c_str(), (unsigned long long) _count, _min, _max, mean() );
+        os << buf;
+        for(auto& b:_bins)
+        {
+            snprintf( buf, sizeof(buf), "    [%g,%g) %llu\n", b.first * _binwidth, ( b.first + 1 ) * _binwidth,
+                (unsigned long long) b.second );
+            os << buf;
+        }
+    }
+    MeasStats(double binwidth) : _binwidth(binwidth)
+    {
+        if ( not ( binwidth > 0 ) )
+        {
+            cout << "MeasStats: binwidth must be positive, got " << binwidth << endl;
+            exit(1);
+        }
+    }
+};
+
+// A measurement over the steps of a raw file, fed one step at a time in order so
+// that all measurements are taken in the same pass. Crossing times are linearly
+// interpolated between samples.
+class Meas
+{
+protected:
+    const string _name;
+    RawColumn _time;
+    MeasStats _stats;
+    // Whether v crosses level between steps i-1 and i in the direction of edge,
+    // and when
+    bool crossing(RawColumn& v, int i, double level, t_measedge edge, double& t)
+    {
+        if ( i == 0 ) return false;
+        double v0 = v[i-1], v1 = v[i];
+        bool rise = v0 < level and v1 >= level;
+        bool fall = v0 >= level and v1 < level;
+        if ( not ( edge == RISE ? rise : edge == FALL ? fall : rise or fall ) ) return false;
+        t = _time[i-1] + ( level - v0 ) / ( v1 - v0 ) * ( _time[i] - _time[i-1] );
+        return true;
+    }
+public:
+    virtual void step(int i) = 0;
+    // Back to the state before step 0, statistics included
+    virtual void reset() { _stats.clear(); }
+    MeasStats& stats() { return _stats; }
+    void print(ostream& os) { _stats.print(os, _name); }
+    Meas(string name, RawFile& raw, double binwidth) :
+        _name(name), _time( raw.column("time") ), _stats(binwidth) {}
+    virtual ~Meas() {}
+};
+
+// From an edge of one net (at vdd/2) to the next edge of another
+class DelayMeas : public Meas
+{
+    RawColumn _from, _to;
+    t_measedge _fromedge, _toedge;
+    double _start = -1;     // last from edge not yet matched
+public:
+    void step(int i)
+    {
+        double tfrom, tto;
+        bool from = crossing(_from, i, vdd / 2, _fromedge, tfrom);
+        bool to = crossing(_to, i, vdd / 2, _toedge, tto);
+        // both edges within one step, as with a coarse time step
+        if ( from and to and tfrom <= tto )
+        {
+            _stats.add( tto - tfrom );
+            _start = -1;
+            return;
+        }
+        if ( to and _start >= 0 )
+        {
+            _stats.add( tto - _start );
+            _start = -1;
+        }
+        if ( from ) _start = tfrom;
+    }
+    void reset()
+    {
+        Meas::reset();
+        _start = -1;
+    }
+    DelayMeas(string name, RawFile& raw, string from, t_measedge fromedge, string to, t_measedge toedge,
+        double binwidth) :
+        Meas(name, raw, binwidth), _from( raw.column(from) ), _to( raw.column(to) ),
+        _fromedge(fromedge), _toedge(toedge) {}
+};
+
+// 10-90% rise time or 90-10% fall time, for transitions that go straight through
+class SlewMeas : public Meas
+{
+    RawColumn _net;
+    t_measedge _edge;
+    double _risestart = -1, _fallstart = -1;
+public:
+    void step(int i)
+    {
+        double lo = 0.1 * vdd, hi = 0.9 * vdd, t;
+        // leaving the band the wrong way cancels the pending transition
+        if ( crossing(_net, i, lo, RISE, t) ) _risestart = t;
+        if ( crossing(_net, i, hi, FALL, t) ) _fallstart = t;
+        if ( crossing(_net, i, lo, FALL, t) )
+        {
+            if ( _fallstart >= 0 and _edge != RISE ) _stats.add( t - _fallstart );
+            _fallstart = _risestart = -1;
+        }
+        if ( crossing(_net, i, hi, RISE, t) )
+        {
+            if ( _risestart >= 0 and _edge != FALL ) _stats.add( t - _risestart );
+            _risestart = _fallstart = -1;
+        }
+    }
+    void reset()
+    {
+        Meas::reset();
+        _risestart = _fallstart = -1;
+    }
+    SlewMeas(string name, RawFile& raw, string net, t_measedge edge, double binwidth) :
+        Meas(name, raw, binwidth), _net( raw.column(net) ), _edge(edge) {}
+};
+
+// Widths of the pulses of a net (between crossings of vdd/2) shorter than maxwidth
+class GlitchMeas : public Meas
+{
+    RawColumn _net;
+    double _maxwidth;
+    double _last = -1;  // last crossing
+public:
+    void step(int i)
+    {
+        double t;
+        if ( not crossing(_net, i, vdd / 2, EITHER, t) ) return;
+        if ( _last >= 0 and t - _last < _maxwidth ) _stats.add( t - _last );
+        _last = t;
+    }
+    void reset()
+    {
+        Meas::reset();
+        _last = -1;
+    }
+    GlitchMeas(string name, RawFile& raw, string net, double maxwidth, double binwidth) :
+        Meas(name, raw, binwidth), _net( raw.column(net) ), _maxwidth(maxwidth) {}
+};
+
+#endif
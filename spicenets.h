@@ -0,0 +1,150 @@
+#ifndef _SPICENETS_H
+#define _SPICENETS_H
+
+// Needs C++20 (class type template parameters)
+
+#include <array>
+#include <tuple>
+#include <string_view>
+#include <utility>
+#include "spiceif.h"
+
+using namespace std;
+
+// String literal usable as a template argument, e.g. Scalar<"clk">
+template <size_t N> struct fixed_string
+{
+    char s[N] {};
+    constexpr fixed_string(const char (&str)[N]) { copy_n(str, N, s); }
+    constexpr string_view view() const { return string_view(s, N - 1); }
+};
+
+// Nets whose name and width are part of their type. They are final, so that calls
+// on them through the Nets group below are resolved at compile time.
+template <fixed_string nm, t_dir dir = OUT> class Scalar final : public ScalarNet
+{
+public:
+    static constexpr string_view netname = nm.view();
+    Scalar() : ScalarNet( string(netname), dir ) {}
+};
+
+template <fixed_string nm, int sz, t_dir dir = OUT> class Vector final : public VectorNet<sz>
+{
+public:
+    static constexpr string_view netname = nm.view();
+    Vector() : VectorNet<sz>( string(netname), dir ) {}
+};
+
+// A testbench's nets declared as one type, e.g.
+//     Nets< Scalar<"clk",IN>, Vector<"data",32,IN>, Vector<"q",32> > nets;
+// The nets are members of the group, not heap nodes, and are looked up by name at
+// compile time with get<"data">(). The group is to be created after the SpiceIf, on
+// the same thread (or after SpiceIf::bind), and registered with SpiceIf::addNets.
+// NetsTraceSink prints the group without virtual calls.
+template <typename... N> class Nets
+{
+    static constexpr size_t _n = sizeof...(N);
+    static constexpr array<string_view, _n> _names { N::netname... };
+    tuple<N...> _nets;
+    static constexpr size_t indexOf(string_view name)
+    {
+        for(size_t i=0; i<_n; i++)
+            if ( _names[i] == name ) return i;
+        return _n;
+    }
+    static constexpr bool unique()
+    {
+        for(size_t i=0; i<_n; i++)
+            if ( indexOf(_names[i]) != i ) return false;
+        return true;
+    }
+    static_assert( unique(), "Nets: duplicate net name" );
+    // Indices in name order, which is the order SpiceIf's text trace uses
+    static constexpr array<size_t, _n> sortedOrder()
+    {
+        array<size_t, _n> order {};
+        for(size_t i=0; i<_n; i++) order[i] = i;
+        sort( order.begin(), order.end(),
+            [](size_t a, size_t b) { return _names[a] < _names[b]; } );
+        return order;
+    }
+    static constexpr array<size_t, _n> _order = sortedOrder();
+    // Position of the time net among the sorted names
+    static constexpr size_t timePos()
+    {
+        size_t pos = 0;
+        for(auto name:_names)
+            if ( name < "time" ) pos++;
+        return pos;
+    }
+    template <size_t I> void printAt(ostream& os, TimeNet *timenet)
+    {
+        if constexpr ( I == timePos() ) if ( timenet ) timenet->print(os);
+        if constexpr ( I < _n ) std::get<_order[I]>(_nets).print(os);
+    }
+    template <size_t... I> void printSorted(ostream& os, TimeNet *timenet, index_sequence<I...>)
+    {
+        ( printAt<I>(os, timenet), ... );
+    }
+public:
+    static constexpr size_t size() { return _n; }
+    template <fixed_string name> auto& get()
+    {
+        constexpr auto i = indexOf( name.view() );
+        static_assert( i < _n, "Nets: no net of this name" );
+        return std::get<i>(_nets);
+    }
+    template <typename F> void forEach(F f) { apply( [&](auto&... n) { ( f(n), ... ); }, _nets ); }
+    // Ports for SpiceIf::instantiate, all nets in declaration order if no names are given
+    template <fixed_string... names> list<Net*> ports()
+    {
+        if constexpr ( sizeof...(names) == 0 )
+            return apply( [](auto&... n) { return list<Net*> { &n... }; }, _nets );
+        else return list<Net*> { &get<names>()... };
+    }
+    // Same as the text trace's dump of these nets, with time among them if given
+    void print(ostream& os, TimeNet *timenet = NULL)
+    {
+        printSorted( os, timenet, make_index_sequence<_n + 1>() );
+    }
+    void report()
+    {
+        print(cout);
+        cout.flush();
+    }
+};
+
+// Text trace of a Nets group only, in the same format as the default text trace
+template <typename G> class NetsTraceSink : public TraceSink
+{
+    G& _group;
+    TraceWriter& _writer;
+    TimeNet *_timenet = NULL;
+    ostringstream _os;
+    void push()
+    {
+        _writer.write( _os.str() );
+        _os.str("");
+    }
+public:
+    void begin(map<string,Net*>& nets)
+    {
+        auto it = nets.find("time");
+        if ( it != nets.end() ) _timenet = (TimeNet*) it->second;
+    }
+    void timestep(int vecindex)
+    {
+        _os << "timestep=" << vecindex << "\n";
+        push();
+    }
+    void dump(map<string,Net*>& nets, char sep, int vecindex, double time)
+    {
+        _group.print(_os, _timenet);
+        _os << string(19,sep) << "\n";
+        push();
+    }
+    void flush() { _writer.flush(); }
+    NetsTraceSink(G& group, TraceWriter& writer) : _group(group), _writer(writer) {}
+};
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef _SPICEPERF_H
+#define _SPICEPERF_H
+
+// Counters of where time goes in SpiceIf and SpiceDbg. They are compiled in only
+// with -DSPICEPERF, without it this header is not even included.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <stdio.h>
+
+using namespace std;
+
+// Durations in power of 2 buckets of ns, bucket b holding [2^(b-1), 2^b)
+class PerfHist
+{
+    uint64_t _buckets[64] = {};
+    uint64_t _count = 0;
+    uint64_t _totalns = 0;
+    uint64_t _maxns = 0;
+public:
+    void add(uint64_t ns)
+    {
+        _buckets[ ns ? 64 - __builtin_clzll(ns) : 0 ]++;
+        _count++;
+        _totalns += ns;
+        if ( ns > _maxns ) _maxns = ns;
+    }
+    uint64_t count() { return _count; }
+    uint64_t totalns() { return _totalns; }
+    double meanns() { return _count ? double(_totalns) / _count : 0; }
+    // Upper bound of the bucket holding the p'th fraction of the samples
+    uint64_t percentilens(double p)
+    {
+        uint64_t seen = 0;
+        for(int b=0; b<64; b++)
+        {
+            seen += _buckets[b];
+            if ( seen and seen >= p * _count ) return b ? uint64_t(1) << b : 1;
+        }
+        return 0;
+    }
+    void print(ostream& os, string name)
+    {
+        char buf[256];
+        snprintf( buf, sizeof(buf), "%-14s calls=%-10llu total=%.3fms mean=%.0fns p50<%lluns p99<%lluns max=%lluns\n",
+            name.c_str(), (unsigned long long) _count, _totalns / 1e6, meanns(),
+            (unsigned long long) percentilens(0.5), (unsigned long long) percentilens(0.99),
+            (unsigned long long) _maxns );
+        os << buf;
+    }
+    void json(ostream& os)
+    {
+        os << "{\"calls\":" << _count << ",\"total_ns\":" << _totalns << ",\"max_ns\":" << _maxns
+            << ",\"buckets\":[";
+        int last = 63;
+        while ( last > 0 and _buckets[last] == 0 ) last--;
+        for(int b=0; b<=last; b++) os << ( b ? "," : "" ) << _buckets[b];
+        os << "]}";
+    }
+};
+
+// Adds the time from its construction to its destruction to a histogram
+class PerfTimer
+{
+    PerfHist& _hist;
+    chrono::steady_clock::time_point _start;
+public:
+    PerfTimer(PerfHist& hist) : _hist(hist), _start( chrono::steady_clock::now() ) {}
+    ~PerfTimer()
+    {
+        _hist.add( chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now() - _start ).count() );
+    }
+};
+
+class SpicePerf
+{
+public:
+    PerfHist sendData;          // per accepted step
+    PerfHist getVsrc;           // per source value asked for
+    PerfHist handleEvent;       // event handler and scheduled actions
+    uint64_t timepoints = 0;    // distinct times sources were asked for, incl. rejected steps
+    double lastvsrctime = -1;
+    double simtime = 0;         // simulated seconds over all runs
+    double wallsecs = 0;        // wall clock seconds spent in run/runBg
+    uint64_t tracebytes = 0;
+    uint64_t playsteps = 0;
+    double playsecs = 0;
+    string jsonfile;            // if set, json is written there along with the summary
+    void vsrcTime(double t)
+    {
+        if ( t != lastvsrctime ) timepoints++;
+        lastvsrctime = t;
+    }
+    void print(ostream& os)
+    {
+        os << "---- spiceperf ----\n";
+        if ( sendData.count() )
+        {
+            sendData.print(os, "sendData");
+            getVsrc.print(os, "getVsrcData");
+            handleEvent.print(os, "handleEvent");
+            char buf[256];
+            snprintf( buf, sizeof(buf), "steps accepted=%llu timepoints=%llu simtime=%gs wall=%.3fs"
+                " sim/wall=%g trace=%lluB\n",
+                (unsigned long long) sendData.count(), (unsigned long long) timepoints, simtime, wallsecs,
+                wallsecs > 0 ? simtime / wallsecs : 0, (unsigned long long) tracebytes );
+            os << buf;
+            // what the wrapper costs as a share of the wall time, the rest is ngspice
+            if ( wallsecs > 0 )
+                os << "wrapper share=" << ( sendData.totalns() + getVsrc.totalns() ) / 1e9 / wallsecs << "\n";
+        }
+        if ( playsteps )
+            os << "play steps=" << playsteps << " secs=" << playsecs
+                << " steps/s=" << ( playsecs > 0 ? playsteps / playsecs : 0 ) << "\n";
+        os.flush();
+    }
+    string json()
+    {
+        ostringstream os;
+        os << "{\"sendData\":";
+        sendData.json(os);
+        os << ",\"getVsrcData\":";
+        getVsrc.json(os);
+        os << ",\"handleEvent\":";
+        handleEvent.json(os);
+        os << ",\"timepoints\":" << timepoints << ",\"simtime\":" << simtime << ",\"wallsecs\":" << wallsecs
+            << ",\"tracebytes\":" << tracebytes << ",\"playsteps\":" << playsteps
+            << ",\"playsecs\":" << playsecs << "}\n";
+        return os.str();
+    }
+    void writeJson(string flnm)
+    {
+        ofstream ofs(flnm);
+        if ( not ofs )
+        {
+            cout << "SpicePerf: could not write " << flnm << endl;
+            return;
+        }
+        ofs << json();
+    }
+    // At the end of the owning object's life
+    void finish()
+    {
+        print(cout);
+        if ( not jsonfile.empty() ) writeJson(jsonfile);
+    }
+};
+
+#endif
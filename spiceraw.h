@@ -0,0 +1,386 @@
+#ifndef _SPICERAW_H
+#define _SPICERAW_H
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "spicetrace.h"
+
+using namespace std;
+
+// Rows first .. first+npoints-1 of a chunked raw file, in place in the mapping
+typedef struct
+{
+    const char *rows;
+    size_t first;
+    size_t npoints;
+} t_rawchunk;
+
+// Strided view of the samples of one variable. Rows in a binary raw file are not
+// necessarily 8 byte aligned, hence the memcpy, which compiles to a plain load.
+// In a chunked file the rows are found through the file's chunk table.
+class RawColumn
+{
+    const char *_base = NULL;
+    size_t _stride = 0; // in bytes
+    size_t _length = 0;
+    const vector<t_rawchunk> *_chunks = NULL;
+    size_t _offset = 0;         // of the column in a row of a chunk
+    size_t _chunkpoints = 0;    // if all chunks but the last have that many rows
+    const char *chunkRow(size_t i) const
+    {
+        auto& chunks = *_chunks;
+        size_t c;
+        if ( _chunkpoints ) c = i / _chunkpoints;
+        else c = upper_bound( chunks.begin(), chunks.end(), i,
+            [](size_t i, const t_rawchunk& ch) { return i < ch.first; } ) - chunks.begin() - 1;
+        return chunks[c].rows + ( i - chunks[c].first ) * _stride;
+    }
+public:
+    double operator[](size_t i) const
+    {
+        double v;
+        if ( _chunks ) memcpy( &v, chunkRow(i) + _offset, sizeof(v) );
+        else memcpy( &v, _base + i * _stride, sizeof(v) );
+        return v;
+    }
+    size_t length() const { return _length; }
+    RawColumn(const char *base, size_t stride, size_t length) :
+        _base(base), _stride(stride), _length(length) {}
+    RawColumn(const vector<t_rawchunk> *chunks, size_t chunkpoints, size_t offset, size_t stride, size_t length) :
+        _stride(stride), _length(length), _chunks(chunks), _offset(offset), _chunkpoints(chunkpoints) {}
+    RawColumn() {}
+};
+
+// Chunked raw file written while the simulation runs, so that memory use stays
+// bounded and a run that is cut short still leaves a readable file. Records:
+//     "SPRAWHDR" u32 nvars, per var u32 name length, name
+//     "SPRAWCHK" u64 npoints, npoints rows of nvars f64
+//     "SPRAWIDX" u64 nchunks, per chunk u64 offset, u64 npoints, then u64 offset
+//         of this record and "SPRAWEND"
+// An index record follows every indexevery chunks and ends the file on close.
+class RawStreamWriter
+{
+    TraceWriter _writer;
+    const size_t _chunkpoints;
+    const size_t _indexevery;
+    size_t _nvars = 0;
+    vector<double> _chunk;
+    size_t _npoints = 0;    // in _chunk
+    uint64_t _offset = 0;   // of the next record
+    vector<uint64_t> _index; // offset, npoints per chunk
+    string _rec;
+    bool _begun = false;
+    template <typename T> void put(T val) { _rec.append( (char*) &val, sizeof(T) ); }
+    void emit()
+    {
+        _writer.write(_rec);
+        _offset += _rec.size();
+        _rec.clear();
+    }
+    void flushChunk()
+    {
+        if ( _npoints == 0 ) return;
+        _index.push_back(_offset);
+        _index.push_back(_npoints);
+        _rec = "SPRAWCHK";
+        put<uint64_t>(_npoints);
+        emit();
+        auto nbytes = _npoints * _nvars * sizeof(double);
+        _writer.write( (char*) _chunk.data(), nbytes );
+        _offset += nbytes;
+        _npoints = 0;
+        if ( ( _index.size() / 2 ) % _indexevery == 0 ) writeIndex();
+    }
+    void writeIndex()
+    {
+        auto idxofs = _offset;
+        _rec = "SPRAWIDX";
+        put<uint64_t>( _index.size() / 2 );
+        for(auto v:_index) put<uint64_t>(v);
+        put<uint64_t>(idxofs);
+        _rec += "SPRAWEND";
+        emit();
+    }
+public:
+    bool begun() { return _begun; }
+    void begin(const vector<string>& names)
+    {
+        _begun = true;
+        _nvars = names.size();
+        _chunk.resize( _chunkpoints * _nvars );
+        _rec = "SPRAWHDR";
+        put<uint32_t>(_nvars);
+        for(auto& n:names)
+        {
+            put<uint32_t>( n.size() );
+            _rec += n;
+        }
+        emit();
+    }
+    // row holds nvars values, in the order of the names given to begin
+    void append(const double *row)
+    {
+        copy( row, row + _nvars, &_chunk[ _npoints * _nvars ] );
+        if ( ++_npoints == _chunkpoints ) flushChunk();
+    }
+    // Writes out what is buffered with an index record and waits for it to reach the file
+    void close()
+    {
+        if ( not _begun ) return;
+        flushChunk();
+        if ( _index.empty() or ( _index.size() / 2 ) % _indexevery ) writeIndex();
+        _writer.flush();
+    }
+    RawStreamWriter(string flnm, size_t chunkpoints = 1024, size_t indexevery = 16) :
+        _writer(flnm), _chunkpoints( max( chunkpoints, size_t(1) ) ),
+        _indexevery( max( indexevery, size_t(1) ) ) {}
+};
+
+// Reader for the first plot of an ngspice raw file. Binary files are mmapped and
+// accessed in place, chunks of files written by RawStreamWriter included, ASCII
+// files are parsed into an owned row major array.
+class RawFile
+{
+    int _fd = -1;
+    const char *_map = NULL;
+    size_t _size = 0;
+    vector<double> _owned;
+    vector<string> _names;
+    map<string,int> _index;
+    int _nvars = 0;
+    size_t _npoints = 0;
+    bool _complex = false;
+    const char *_data = NULL;
+    size_t _rowbytes = 0;
+    vector<t_rawchunk> _chunks; // of a chunked file
+    size_t _chunkpoints = 0;
+    static string lower(string s)
+    {
+        transform( s.begin(), s.end(), s.begin(), ::tolower );
+        return s;
+    }
+    void error(string msg)
+    {
+        cout << "RawFile: " << msg << endl;
+        exit(1);
+    }
+    // Returns the line starting at pos and moves pos past it
+    string getline(size_t& pos)
+    {
+        auto eol = (const char*) memchr( _map + pos, '\n', _size - pos );
+        size_t end = eol ? eol - _map : _size;
+        string line( _map + pos, end - pos );
+        pos = eol ? end + 1 : _size;
+        if ( not line.empty() and line.back() == '\r' ) line.pop_back();
+        return line;
+    }
+    void addName(int col, string name)
+    {
+        name = lower(name);
+        _names.push_back(name);
+        _index.emplace(name, col);
+        // node voltages are written as v(node), allow lookups by plain node name too
+        if ( name.size() > 3 and name.compare(0,2,"v(") == 0 and name.back() == ')' )
+            _index.emplace( name.substr( 2, name.size() - 3 ), col );
+    }
+    void parseValues(size_t pos)
+    {
+        int width = _complex ? 2 : 1;
+        _owned.resize( _npoints * _nvars * width );
+        const char *p = _map + pos, *end = _map + _size;
+        size_t n = 0;
+        // Each point is its index followed by nvars values, complex ones as re,im
+        for(size_t pt=0; pt<_npoints and p < end; pt++)
+        {
+            char *next;
+            strtol( p, &next, 10 );
+            if ( next == p ) break;
+            p = next;
+            for(int v=0; v<_nvars*width; v++)
+            {
+                while ( p < end and ( isspace(*p) or *p == ',' ) ) p++;
+                _owned[n++] = strtod( p, &next );
+                if ( next == p ) error("malformed value in ASCII raw data");
+                p = next;
+            }
+        }
+        _npoints = n / ( _nvars * width );
+        _data = (const char*) _owned.data();
+    }
+    // Callers check that pos + sizeof(T) <= _size
+    template <typename T> T get(size_t pos)
+    {
+        T val;
+        memcpy( &val, _map + pos, sizeof(T) );
+        return val;
+    }
+    bool magic(size_t pos, const char *m) { return pos <= _size and _size - pos >= 8 and memcmp( _map + pos, m, 8 ) == 0; }
+    // Number of rows of the chunk record at pos, -1 if it is not one or goes past the end
+    int64_t chunkAt(size_t pos)
+    {
+        if ( not magic( pos, "SPRAWCHK" ) or _size - pos < 16 ) return -1;
+        auto npoints = get<uint64_t>( pos + 8 );
+        if ( npoints > ( _size - pos - 16 ) / _rowbytes ) return -1;
+        return npoints;
+    }
+    void addChunk(size_t pos, size_t npoints)
+    {
+        if ( npoints == 0 ) return;
+        _chunks.push_back( { _map + pos + 16, _npoints, npoints } );
+        _npoints += npoints;
+    }
+    // Chunks as listed by the final index, false if it is missing or inconsistent
+    bool readIndex()
+    {
+        if ( _size < 16 or not magic( _size - 8, "SPRAWEND" ) ) return false;
+        auto idxpos = get<uint64_t>( _size - 16 );
+        if ( not magic( idxpos, "SPRAWIDX" ) or _size - idxpos < 16 ) return false;
+        auto nchunks = get<uint64_t>( idxpos + 8 );
+        if ( nchunks > ( _size - idxpos - 16 ) / 16 ) return false;
+        for(uint64_t c=0; c<nchunks; c++)
+        {
+            auto chunkpos = get<uint64_t>( idxpos + 16 + c * 16 );
+            auto npoints = get<uint64_t>( idxpos + 24 + c * 16 );
+            if ( chunkAt(chunkpos) != (int64_t) npoints ) return false;
+            addChunk( chunkpos, npoints );
+        }
+        return true;
+    }
+    void parseChunked()
+    {
+        size_t pos = 8;
+        if ( _size < 12 ) error("truncated header");
+        _nvars = get<uint32_t>(pos);
+        if ( _nvars <= 0 ) error("no variables found in header");
+        pos += 4;
+        for(int i=0; i<_nvars; i++)
+        {
+            if ( pos + 4 > _size ) error("truncated header");
+            auto len = get<uint32_t>(pos);
+            if ( pos + 4 + len > _size ) error("truncated header");
+            addName( i, string( _map + pos + 4, len ) );
+            pos += 4 + len;
+        }
+        _rowbytes = _nvars * sizeof(double);
+        // A complete file ends with an index; otherwise the chunks are scanned
+        // up to the first incomplete one
+        if ( not readIndex() )
+        {
+            _chunks.clear();
+            _npoints = 0;
+            while ( true )
+            {
+                auto npoints = chunkAt(pos);
+                if ( npoints >= 0 )
+                {
+                    addChunk( pos, npoints );
+                    pos += 16 + npoints * _rowbytes;
+                }
+                else if ( magic( pos, "SPRAWIDX" ) and _size - pos >= 32
+                    and get<uint64_t>( pos + 8 ) <= ( _size - pos - 32 ) / 16 )
+                    pos += 16 + get<uint64_t>( pos + 8 ) * 16 + 16;
+                else break;
+            }
+        }
+        // the writer makes all chunks but the last equally long, their rows are then found by a division
+        _chunkpoints = _chunks.empty() ? 0 : _chunks[0].npoints;
+        for(size_t c=0; c+1<_chunks.size(); c++)
+            if ( _chunks[c].npoints != _chunkpoints ) _chunkpoints = 0;
+    }
+    void parse()
+    {
+        if ( magic(0, "SPRAWHDR") ) return parseChunked();
+        size_t pos = 0;
+        while ( pos < _size )
+        {
+            auto line = getline(pos);
+            auto colon = line.find(':');
+            if ( colon == string::npos ) continue;
+            auto key = lower( line.substr(0,colon) );
+            auto val = line.substr( colon + 1 );
+            if ( key == "flags" ) _complex = lower(val).find("complex") != string::npos;
+            else if ( key == "no. variables" ) _nvars = atoi( val.c_str() );
+            else if ( key == "no. points" ) _npoints = atol( val.c_str() );
+            else if ( key == "variables" )
+            {
+                for(int i=0; i<_nvars; i++)
+                {
+                    // index name type [dims=...]
+                    auto varline = getline(pos);
+                    char name[1024];
+                    int idx;
+                    if ( sscanf( varline.c_str(), "%d %1023s", &idx, name ) != 2 )
+                        error( "malformed variable line: " + varline );
+                    addName(i, name);
+                }
+            }
+            else if ( key == "binary" or key == "values" )
+            {
+                if ( _nvars == 0 ) error("no variables found in header");
+                _rowbytes = _nvars * sizeof(double) * ( _complex ? 2 : 1 );
+                if ( key == "binary" )
+                {
+                    _data = _map + pos;
+                    // a run that was cut short leaves fewer rows than announced
+                    _npoints = min( _npoints, ( _size - pos ) / _rowbytes );
+                }
+                else parseValues(pos);
+                return;
+            }
+        }
+        error("no Binary: or Values: section found");
+    }
+public:
+    int vars() { return _nvars; }
+    size_t points() { return _npoints; }
+    const vector<string>& names() { return _names; }
+    bool has(string name) { return _index.find( lower(name) ) != _index.end(); }
+    // Column number of the named variable, -1 if there is none
+    int col(string name)
+    {
+        auto it = _index.find( lower(name) );
+        return it == _index.end() ? -1 : it->second;
+    }
+    // Real part of the named variable
+    RawColumn column(string name)
+    {
+        auto it = _index.find( lower(name) );
+        if ( it == _index.end() ) error( "no variable named " + name );
+        return column( it->second );
+    }
+    RawColumn column(int col)
+    {
+        size_t colbytes = sizeof(double) * ( _complex ? 2 : 1 );
+        if ( not _chunks.empty() ) return RawColumn( &_chunks, _chunkpoints, col * colbytes, _rowbytes, _npoints );
+        return RawColumn( _data + col * colbytes, _rowbytes, _npoints );
+    }
+    RawFile(string flnm)
+    {
+        _fd = open( flnm.c_str(), O_RDONLY );
+        if ( _fd < 0 ) error( "could not open " + flnm );
+        struct stat st;
+        fstat( _fd, &st );
+        _size = st.st_size;
+        if ( _size == 0 ) error( flnm + " is empty" );
+        auto m = mmap( NULL, _size, PROT_READ, MAP_PRIVATE, _fd, 0 );
+        if ( m == MAP_FAILED ) error( "could not mmap " + flnm );
+        _map = (const char*) m;
+        parse();
+    }
+    ~RawFile()
+    {
+        munmap( (void*) _map, _size );
+        close(_fd);
+    }
+};
+
+#endif
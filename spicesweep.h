@@ -0,0 +1,270 @@
+#ifndef _SPICESWEEP_H
+#define _SPICESWEEP_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <cerrno>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "spiceconf.h"
+#include "spicefarm.h"
+#include "spicetrim.h"
+
+using namespace std;
+
+// One point of a sweep: library section, supply and Monte Carlo seed (0 for none)
+class SweepPoint
+{
+public:
+    string corner;
+    double vdd;
+    int seed;
+    string name()
+    {
+        char buf[64];
+        snprintf( buf, sizeof(buf), "_%.12gV", vdd );
+        return corner + buf + ( seed ? "_s" + to_string(seed) : "" );
+    }
+};
+
+class SweepResult : public FarmResult
+{
+public:
+    SweepPoint point;
+    bool cached = false;        // taken from a previous sweep
+    map<string,string> values;  // key=value lines of the report
+};
+
+// Runs the same testbench over corners x Vdd values x seeds on a SpiceFarm. For
+// each point it writes outdir/<point>.sp, which loads the corner of the library
+// (trimmed with SpiceTrim unless disabled), sets the seed and includes the
+// circuit; the testbench is to pass job.initfile to its SpiceIf. Raw file and log
+// go to outdir/<point>.raw and .log.
+//
+// A finished point leaves outdir/<point>.done (pass flag, exit status, report),
+// and is not run again as long as its init file, which holds a hash of the
+// circuit (and of the library when not trimmed), is unchanged, so an interrupted
+// sweep resumes where it stopped. The reports' key=value lines are collected into
+// outdir/sweep.csv, one row per point.
+class SpiceSweep
+{
+public:
+    typedef function<bool(SweepPoint&, FarmJob&, string& report)> t_bench;
+private:
+    string _libfile;
+    string _cktfile;
+    string _outdir;
+    vector<string> _corners { "tt" };
+    vector<double> _vdds { vdd };
+    vector<int> _seeds { 0 };
+    bool _trim = true;
+    list<string> _extralines;
+    static void error(string msg)
+    {
+        cout << "SpiceSweep: " << msg << endl;
+        exit(1);
+    }
+    static bool readFile(string flnm, string& text)
+    {
+        ifstream ifs(flnm);
+        if ( not ifs ) return false;
+        stringstream ss;
+        ss << ifs.rdbuf();
+        text = ss.str();
+        return true;
+    }
+    // Written under a temporary name so that an interrupted sweep leaves no partial file
+    static void writeFile(string flnm, string text)
+    {
+        auto tmpfile = flnm + ".tmp";
+        ofstream ofs(tmpfile);
+        if ( not ofs or not ( ofs << text ) ) error( "could not write " + tmpfile );
+        ofs.close();
+        if ( rename( tmpfile.c_str(), flnm.c_str() ) ) error( "could not write " + flnm );
+    }
+    string path(SweepPoint& pt, string ext) { return _outdir + "/" + pt.name() + ext; }
+    // Hash and model lines of a corner's init files, the same for all its points
+    string modelText(string corner, string ckthash)
+    {
+        ostringstream os;
+        // the files included by path, so that editing them reruns the point
+        os << "* hash " << ckthash;
+        if ( not _trim )
+        {
+            char hex[17];
+            snprintf( hex, sizeof(hex), "%016llx", (unsigned long long) SpiceTrim::hash(_libfile, corner) );
+            os << " " << hex;
+        }
+        os << "\n";
+        if ( _trim ) os << ".include " << SpiceTrim::trim( _libfile, corner, {_cktfile}, _outdir ) << "\n";
+        else os << ".lib \"" << _libfile << "\" " << corner << "\n";
+        return os.str();
+    }
+    string initText(SweepPoint& pt, const string& models)
+    {
+        ostringstream os;
+        os << "* sweep point " << pt.name() << "\n";
+        os << models;
+        if ( pt.seed ) os << ".option seed=" << pt.seed << "\n";
+        for(auto& l:_extralines) os << l << "\n";
+        os << ".include " << _cktfile << "\n";
+        return os.str();
+    }
+    // The init file is rewritten, and the point's result dropped, only if it changed
+    bool prepare(SweepPoint& pt, const string& models)
+    {
+        auto text = initText(pt, models);
+        string old;
+        if ( readFile( path(pt, ".sp"), old ) and old == text ) return true;
+        unlink( path(pt, ".done").c_str() );
+        writeFile( path(pt, ".sp"), text );
+        return false;
+    }
+    bool loadDone(SweepPoint& pt, SweepResult& r)
+    {
+        string text;
+        if ( not readFile( path(pt, ".done"), text ) ) return false;
+        istringstream is(text);
+        string line;
+        int pass;
+        if ( not getline(is, line) or sscanf( line.c_str(), "%d %d", &pass, &r.status ) != 2 )
+            return false;
+        r.pass = pass;
+        r.report = text.substr( min( line.size() + 1, text.size() ) );
+        r.cached = true;
+        return true;
+    }
+    static void parseValues(SweepResult& r)
+    {
+        istringstream is(r.report);
+        string line;
+        while ( getline(is, line) )
+        {
+            auto eq = line.find('=');
+            if ( eq != string::npos and eq > 0 ) r.values[ line.substr(0,eq) ] = line.substr(eq+1);
+        }
+    }
+    static string csvField(string s)
+    {
+        if ( s.find_first_of(",\"\n") == string::npos ) return s;
+        string q = "\"";
+        for(auto c:s) q += c == '"' ? string("\"\"") : string(1,c);
+        return q + "\"";
+    }
+    void writeTable(vector<SweepResult>& results)
+    {
+        vector<string> keys;
+        for(auto& r:results)
+            for(auto& kv:r.values)
+                if ( find( keys.begin(), keys.end(), kv.first ) == keys.end() ) keys.push_back(kv.first);
+        ostringstream os;
+        os << "point,corner,vdd,seed,pass,status";
+        for(auto& k:keys) os << "," << csvField(k);
+        os << "\n";
+        for(auto& r:results)
+        {
+            os << r.name << "," << csvField(r.point.corner) << "," << r.point.vdd << "," << r.point.seed
+                << "," << r.pass << "," << r.status;
+            for(auto& k:keys)
+            {
+                auto it = r.values.find(k);
+                os << "," << ( it == r.values.end() ? "" : csvField(it->second) );
+            }
+            os << "\n";
+        }
+        writeFile( _outdir + "/sweep.csv", os.str() );
+    }
+public:
+    void corners(vector<string> c) { _corners = c; }
+    void vdds(vector<double> v) { _vdds = v; }
+    void seeds(vector<int> s) { _seeds = s; }
+    // Seeds 1..n
+    void seeds(int n)
+    {
+        _seeds.clear();
+        for(int s=1; s<=n; s++) _seeds.push_back(s);
+    }
+    // Include the whole library section instead of a trimmed copy
+    void trimModels(bool enable) { _trim = enable; }
+    // Added to every init file before the circuit, e.g. .param mc_mm_switch=1
+    void addLine(string line) { _extralines.push_back(line); }
+    vector<SweepPoint> points()
+    {
+        vector<SweepPoint> pts;
+        set<string> names;
+        for(auto& c:_corners)
+            for(auto v:_vdds)
+                for(auto s:_seeds)
+                {
+                    pts.push_back( { c, v, s } );
+                    // points sharing a name would share their files
+                    auto name = pts.back().name();
+                    if ( not names.insert(name).second ) error( "duplicate sweep point " + name );
+                }
+        return pts;
+    }
+    // Runs the points not done yet, results are in the order of points()
+    vector<SweepResult> run(t_bench bench, int nworkers = 0)
+    {
+        if ( mkdir( _outdir.c_str(), 0755 ) and errno != EEXIST ) error( "could not create " + _outdir );
+        auto pts = points();
+        char hex[17];
+        snprintf( hex, sizeof(hex), "%016llx", (unsigned long long) SpiceTrim::hash(_cktfile) );
+        map<string,string> models;
+        for(auto& c:_corners) models[c] = modelText(c, hex);
+        vector<SweepResult> results( pts.size() );
+        vector<int> pending;
+        SpiceFarm farm(nworkers);
+        for(size_t i=0; i<pts.size(); i++)
+        {
+            auto& pt = pts[i];
+            results[i].point = pt;
+            if ( prepare( pt, models[pt.corner] ) and loadDone(pt, results[i]) ) continue;
+            FarmJob job;
+            job.name = pt.name();
+            job.initfile = path(pt, ".sp");
+            job.logfile = path(pt, ".log");
+            job.conf.rawopfile = path(pt, ".raw");
+            job.conf.vdd = pt.vdd;
+            job.conf.logicthresh = logicthresh * pt.vdd / vdd; // same fraction of Vdd
+            job.run = [pt, bench](FarmJob& job, string& report) mutable { return bench(pt, job, report); };
+            farm.add(job);
+            pending.push_back(i);
+        }
+        auto farmed = farm.run();
+        for(size_t j=0; j<farmed.size(); j++)
+        {
+            auto& r = results[ pending[j] ];
+            (FarmResult&) r = farmed[j];
+            // crashed points are not cached, they run again next time
+            if ( r.status == 0 )
+                writeFile( path(r.point, ".done"), to_string(r.pass) + " " + to_string(r.status) + "\n" + r.report );
+        }
+        for(size_t i=0; i<pts.size(); i++)
+        {
+            auto& r = results[i];
+            if ( r.cached )
+            {
+                r.name = pts[i].name();
+                r.rawfile = path(pts[i], ".raw");
+                r.logfile = path(pts[i], ".log");
+            }
+            parseValues(r);
+        }
+        writeTable(results);
+        return results;
+    }
+    SpiceSweep(string libfile, string cktfile, string outdir = "sweep") :
+        _libfile(libfile), _cktfile(cktfile), _outdir(outdir) {}
+};
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef _SPICETRACE_H
+#define _SPICETRACE_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Single producer single consumer byte ring. The producer is ngspice's callback
+// thread, the consumer is the TraceWriter thread. Capacity must be a power of 2.
+class TraceRing
+{
+    vector<char> _buf;
+    const size_t _mask;
+    alignas(64) atomic<size_t> _head {0}; // advanced by producer
+    alignas(64) atomic<size_t> _tail {0}; // advanced by consumer
+public:
+    size_t capacity() { return _buf.size(); }
+    bool empty() { return _head.load(memory_order_acquire) == _tail.load(memory_order_acquire); }
+    // Blocks (yielding) while the ring is full, which is the only back pressure
+    void push(const char *src, size_t n)
+    {
+        auto head = _head.load(memory_order_relaxed);
+        while ( n )
+        {
+            auto avail = capacity() - ( head - _tail.load(memory_order_acquire) );
+            if ( avail == 0 )
+            {
+                this_thread::yield();
+                continue;
+            }
+            auto chunk = min( { n, avail, capacity() - ( head & _mask ) } );
+            copy( src, src + chunk, &_buf[ head & _mask ] );
+            head += chunk;
+            src += chunk;
+            n -= chunk;
+            _head.store(head, memory_order_release);
+        }
+    }
+    // Contiguous readable region, to be followed by consume
+    size_t peek(const char *&p)
+    {
+        auto tail = _tail.load(memory_order_relaxed);
+        auto avail = _head.load(memory_order_acquire) - tail;
+        p = &_buf[ tail & _mask ];
+        return min( avail, capacity() - ( tail & _mask ) );
+    }
+    void consume(size_t n) { _tail.store( _tail.load(memory_order_relaxed) + n, memory_order_release ); }
+    TraceRing(size_t capacity) : _buf(capacity), _mask(capacity - 1)
+    {
+        if ( capacity == 0 or ( capacity & _mask ) )
+        {
+            cout << "TraceRing: capacity must be a power of 2, got " << capacity << endl;
+            exit(1);
+        }
+    }
+};
+
+// Stream buffer appending to a string kept across records, so that formatting a
+// record with << does not allocate once the string has grown to its largest size
+class TraceBuf : public streambuf
+{
+    string _buf;
+protected:
+    int overflow(int c)
+    {
+        if ( c != EOF ) _buf += (char) c;
+        return c;
+    }
+    streamsize xsputn(const char *p, streamsize n)
+    {
+        _buf.append(p, n);
+        return n;
+    }
+public:
+    const char* data() const { return _buf.data(); }
+    size_t size() const { return _buf.size(); }
+    void clear() { _buf.clear(); }
+};
+
+// Background writer that drains a TraceRing into a file (stdout by default) in
+// as large writes as have accumulated. Writers still alive when the process
+// exits, e.g. through one of the exit(1) error paths, are drained first so that
+// the trace leading to the error is not lost. On stdout, what the program prints
+// itself is only ordered with the trace at flush.
+class TraceWriter
+{
+    TraceRing _ring;
+    FILE *_fp;
+    const bool _ownfp;
+    atomic<bool> _stop {false};
+    atomic<size_t> _bytes {0};
+    thread _thread;
+    static inline mutex _livelock;
+    static inline list<TraceWriter*> _live;
+    static void drainAll()
+    {
+        lock_guard<mutex> lock(_livelock);
+        for(auto w:_live)
+            if ( w->_thread.get_id() != this_thread::get_id() ) w->flush();
+        cout.flush();
+    }
+    void writeAll(const char *p, size_t n)
+    {
+        while ( n )
+        {
+            auto written = ::write( fileno(_fp), p, n );
+            if ( written < 0 )
+            {
+                cout << "TraceWriter: write failed" << endl;
+                exit(1);
+            }
+            p += written;
+            n -= written;
+        }
+    }
+    void drain()
+    {
+        while ( true )
+        {
+            const char *p;
+            auto n = _ring.peek(p);
+            if ( n == 0 )
+            {
+                if ( _stop.load(memory_order_acquire) and _ring.empty() ) break;
+                this_thread::sleep_for( chrono::microseconds(200) );
+                continue;
+            }
+            writeAll(p, n);
+            _ring.consume(n);
+        }
+    }
+public:
+    size_t bytes() { return _bytes.load(memory_order_relaxed); }
+    void write(const char *p, size_t n)
+    {
+        _ring.push(p, n);
+        _bytes.fetch_add(n, memory_order_relaxed);
+    }
+    void write(const string& s) { write( s.data(), s.size() ); }
+    void write(const TraceBuf& b) { write( b.data(), b.size() ); }
+    // Waits till everything written so far has reached the file. On stdout what
+    // was printed through cout and stdio goes out first.
+    void flush()
+    {
+        if ( not _ownfp )
+        {
+            cout.flush();
+            fflush(stdout);
+        }
+        while ( not _ring.empty() ) this_thread::yield();
+    }
+    // Empty flnm means stdout
+    TraceWriter(string flnm = "", size_t capacity = 1 << 22) :
+        _ring(capacity),
+        _fp( flnm.empty() ? stdout : fopen( flnm.c_str(), "wb" ) ),
+        _ownfp( not flnm.empty() )
+    {
+        if ( _fp == NULL )
+        {
+            cout << "TraceWriter: could not open " << flnm << endl;
+            exit(1);
+        }
+        fflush(_fp);
+        _thread = thread( [this]() { drain(); } );
+        static once_flag registered;
+        call_once( registered, []() { atexit(drainAll); } );
+        lock_guard<mutex> lock(_livelock);
+        _live.push_back(this);
+    }
+    ~TraceWriter()
+    {
+        {
+            lock_guard<mutex> lock(_livelock);
+            _live.remove(this);
+        }
+        flush();
+        _stop.store(true, memory_order_release);
+        _thread.join();
+        if ( _ownfp ) fclose(_fp);
+    }
+};
+
+#endif
@@ -0,0 +1,310 @@
+#ifndef _SPICETRIM_H
+#define _SPICETRIM_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// Extracts from a section of a model library (e.g. sky130.lib.spice tt) just the
+// .subckt and .model definitions a circuit needs, transitively, along with all
+// the section's other statements (.param, .option ...). The result is cached in
+// cachedir under a name made from a hash of the section and of every file read
+// (library and circuit files and those they include), so that only the first run
+// of a circuit pays for the full library. A manifest next to it, named from the
+// arguments, lists the size and mtime of the files read, so that later runs only
+// stat them instead of reading the whole library.
+class SpiceTrim
+{
+    // A logical line, continuation lines included, in the text it was read as
+    typedef struct { string text; string first; } t_stmt;
+    typedef struct { string path; uint64_t size; int64_t mtime; } t_file;
+    typedef struct { int begin; int end; } t_range; // statements [begin,end)
+    vector<t_stmt> _stmts;
+    vector<bool> _isdef;                // statement belongs to a .subckt or .model
+    map<string,vector<t_range>> _defs;  // name -> its definitions
+    static string lower(string s)
+    {
+        transform( s.begin(), s.end(), s.begin(), ::tolower );
+        return s;
+    }
+    static void error(string msg)
+    {
+        cout << "SpiceTrim: " << msg << endl;
+        exit(1);
+    }
+    static string readFile(string flnm)
+    {
+        ifstream ifs(flnm);
+        if ( not ifs ) error( "could not open " + flnm );
+        stringstream ss;
+        ss << ifs.rdbuf();
+        return ss.str();
+    }
+    static bool fileStat(string flnm, uint64_t& size, int64_t& mtime)
+    {
+        struct stat st;
+        if ( stat( flnm.c_str(), &st ) ) return false;
+        size = st.st_size;
+        // in ns, as an edit within the same second often leaves the same size
+        mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        return true;
+    }
+    static string dirOf(string flnm)
+    {
+        auto pos = flnm.rfind('/');
+        return pos == string::npos ? "" : flnm.substr( 0, pos + 1 );
+    }
+    static string unquote(string s)
+    {
+        if ( s.size() >= 2 and ( s[0] == '"' or s[0] == '\'' ) ) return s.substr( 1, s.size() - 2 );
+        return s;
+    }
+    static vector<string> tokens(const string& text)
+    {
+        vector<string> toks;
+        string tok;
+        for(auto c:text)
+        {
+            if ( isspace(c) or c == '(' or c == ')' or c == '=' or c == ',' or c == '+' )
+            {
+                if ( not tok.empty() ) toks.push_back( lower(tok) );
+                tok.clear();
+            }
+            else tok += c;
+        }
+        if ( not tok.empty() ) toks.push_back( lower(tok) );
+        return toks;
+    }
+    // Splits into logical lines, dropping comments and blank lines
+    static vector<t_stmt> statements(const string& text)
+    {
+        vector<t_stmt> stmts;
+        istringstream is(text);
+        string line;
+        while ( getline(is, line) )
+        {
+            if ( not line.empty() and line.back() == '\r' ) line.pop_back();
+            auto start = line.find_first_not_of(" \t");
+            if ( start == string::npos or line[start] == '*' ) continue;
+            if ( line[start] == '+' and not stmts.empty() ) stmts.back().text += "\n" + line;
+            else
+            {
+                istringstream ls( line.substr(start) );
+                string first;
+                ls >> first;
+                stmts.push_back( { line, lower(first) } );
+            }
+        }
+        return stmts;
+    }
+    // Appends flnm's statements to stmts, expanding .include and .lib file section.
+    // With section empty the whole file is read, except for .lib sections in it.
+    // The names and contents of the files read are hashed into h, their size and
+    // mtime (taken before reading) added to files.
+    static void expand(string flnm, string section, vector<t_stmt>& stmts, uint64_t& h,
+        vector<t_file>& files, int depth = 0)
+    {
+        if ( depth > 32 ) error( "include nesting too deep at " + flnm );
+        auto dir = dirOf(flnm);
+        bool insection = section.empty();
+        bool skipping = false;
+        t_file f = { flnm, 0, 0 };
+        if ( not fileStat( flnm, f.size, f.mtime ) ) error( "could not open " + flnm );
+        files.push_back(f);
+        auto text = readFile(flnm);
+        h = fnv( text, fnv( flnm + "\n", h ) );
+        for(auto& stmt:statements(text))
+        {
+            auto toks = tokens(stmt.text);
+            if ( stmt.first == ".lib" and toks.size() == 2 )
+            {
+                if ( section.empty() ) skipping = true;
+                else if ( toks[1] == lower(section) ) insection = true;
+                continue;
+            }
+            if ( stmt.first == ".endl" )
+            {
+                if ( skipping ) skipping = false;
+                else if ( insection and not section.empty() ) return;
+                continue;
+            }
+            if ( not insection or skipping ) continue;
+            istringstream ls(stmt.text);
+            string cmd, arg1, arg2;
+            ls >> cmd >> arg1 >> arg2;
+            if ( stmt.first == ".include" or stmt.first == ".inc" )
+            {
+                auto inc = unquote(arg1);
+                expand( inc[0] == '/' ? inc : dir + inc, "", stmts, h, files, depth + 1 );
+            }
+            else if ( stmt.first == ".lib" )
+            {
+                auto lib = unquote(arg1);
+                expand( lib[0] == '/' ? lib : dir + lib, arg2, stmts, h, files, depth + 1 );
+            }
+            else stmts.push_back(stmt);
+        }
+        if ( not section.empty() and not insection )
+            error( "section " + section + " not found in " + flnm );
+    }
+    void index()
+    {
+        _isdef.assign( _stmts.size(), false );
+        for(int i=0; i<(int)_stmts.size(); i++)
+        {
+            auto& first = _stmts[i].first;
+            if ( first != ".subckt" and first != ".model" ) continue;
+            auto toks = tokens( _stmts[i].text );
+            if ( toks.size() < 2 ) continue;
+            int end = i + 1;
+            if ( first == ".subckt" )
+                while ( end < (int)_stmts.size() and _stmts[end-1].first != ".ends" ) end++;
+            for(int j=i; j<end; j++) _isdef[j] = true;
+            auto name = toks[1];
+            _defs[name].push_back( { i, end } );
+            // binned models nfet.0, nfet.1 ... are referred to as nfet
+            auto dot = name.rfind('.');
+            if ( first == ".model" and dot != string::npos and dot + 1 < name.size()
+                and all_of( name.begin() + dot + 1, name.end(), ::isdigit ) )
+                _defs[ name.substr(0,dot) ].push_back( { i, end } );
+            i = end - 1;
+        }
+    }
+    // Writes text to flnm under a unique temporary name first, as several processes
+    // or threads may be trimming at once
+    static void writeFile(string flnm, const string& text)
+    {
+        string tmpfile = flnm + ".XXXXXX";
+        int fd = mkstemp( &tmpfile[0] );
+        if ( fd < 0 ) error( "could not create " + tmpfile );
+        fchmod( fd, 0644 );
+        FILE *fp = fdopen( fd, "w" );
+        fwrite( text.data(), 1, text.size(), fp );
+        if ( ferror(fp) or fclose(fp) ) error( "could not write " + tmpfile );
+        if ( rename( tmpfile.c_str(), flnm.c_str() ) ) error( "could not write " + flnm );
+    }
+    // The trimmed file named in the manifest if it exists and none of the files
+    // listed changed, else empty. Manifest: the trimmed file's name, then a line
+    // size mtime path per file read.
+    static string cached(string manifest, string cachedir)
+    {
+        ifstream ifs(manifest);
+        string outname, line;
+        if ( not getline(ifs, outname) or outname.empty() ) return "";
+        int nfiles = 0;
+        while ( getline(ifs, line) )
+        {
+            istringstream ls(line);
+            uint64_t size, cursize;
+            int64_t mtime, curmtime;
+            string path;
+            if ( not ( ls >> size >> mtime ) ) return "";
+            ls.get();
+            getline(ls, path);
+            if ( not fileStat( path, cursize, curmtime ) or cursize != size or curmtime != mtime ) return "";
+            nfiles++;
+        }
+        auto outfile = cachedir + "/" + outname;
+        if ( nfiles == 0 or access( outfile.c_str(), R_OK ) ) return "";
+        return outfile;
+    }
+    // Names in the device statements of stmts that are defined in the library
+    void references(const vector<t_stmt>& stmts, int begin, int end, list<string>& names)
+    {
+        for(int i=begin; i<end; i++)
+        {
+            if ( stmts[i].first.empty() or stmts[i].first[0] == '.' ) continue;
+            auto toks = tokens( stmts[i].text );
+            for(size_t t=1; t<toks.size(); t++)
+                if ( _defs.count(toks[t]) ) names.push_back(toks[t]);
+        }
+    }
+public:
+    static uint64_t fnv(const string& s, uint64_t h = 14695981039346656037ULL)
+    {
+        for(unsigned char c:s)
+        {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+    // Hash of flnm (section of it if not empty) and of the files it includes
+    static uint64_t hash(string flnm, string section = "")
+    {
+        vector<t_stmt> stmts;
+        vector<t_file> files;
+        uint64_t h = fnv( lower(section) + "\n" );
+        expand( flnm, section, stmts, h, files );
+        return h;
+    }
+    static string trim(string libfile, string section, list<string> cktfiles, string cachedir = ".")
+    {
+        char hex[17];
+        auto key = fnv( libfile + "\n" + lower(section) + "\n" );
+        for(auto& f:cktfiles) key = fnv( f + "\n", key );
+        snprintf( hex, sizeof(hex), "%016llx", (unsigned long long) key );
+        auto manifest = cachedir + "/models_" + hex + ".files";
+        auto outfile = cached(manifest, cachedir);
+        if ( not outfile.empty() ) return outfile;
+
+        SpiceTrim st;
+        vector<t_file> files;
+        uint64_t h = fnv( lower(section) + "\n" );
+        expand( libfile, section, st._stmts, h, files );
+        vector<t_stmt> ckt;
+        for(auto& f:cktfiles) expand( f, "", ckt, h, files );
+        snprintf( hex, sizeof(hex), "%016llx", (unsigned long long) h );
+        auto outname = string("models_") + hex + ".spice";
+        outfile = cachedir + "/" + outname;
+        ostringstream mos;
+        mos << outname << "\n";
+        for(auto& f:files) mos << f.size << " " << f.mtime << " " << f.path << "\n";
+        // only touched files, the contents are the same
+        if ( access( outfile.c_str(), R_OK ) == 0 )
+        {
+            writeFile( manifest, mos.str() );
+            return outfile;
+        }
+
+        st.index();
+        list<string> pending;
+        st.references( ckt, 0, ckt.size(), pending );
+        set<string> needed;
+        vector<bool> keep( st._stmts.size(), false );
+        while ( not pending.empty() )
+        {
+            auto name = pending.front();
+            pending.pop_front();
+            if ( not needed.insert(name).second ) continue;
+            for(auto r:st._defs[name])
+            {
+                if ( keep[r.begin] ) continue;
+                fill( keep.begin() + r.begin, keep.begin() + r.end, true );
+                st.references( st._stmts, r.begin + 1, r.end, pending );
+            }
+        }
+        ostringstream os;
+        os << "* trimmed from " << libfile << " " << section << " by spicetrim\n";
+        for(size_t i=0; i<st._stmts.size(); i++)
+            if ( keep[i] or not st._isdef[i] ) os << st._stmts[i].text << "\n";
+        // the trimmed file first, so that a manifest always names an existing one
+        writeFile( outfile, os.str() );
+        writeFile( manifest, mos.str() );
+        return outfile;
+    }
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _SPICEVCD_H
+#define _SPICEVCD_H
+
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+
+using namespace std;
+
+// Minimal change-only VCD writer with a 1fs timescale. Variables are declared
+// with addVar, then endHeader is called once, after which time/change records follow.
+class VcdWriter
+{
+    FILE *_fp;
+    int _nvars = 0;
+    long long _lasttime = -1;
+    // Identifier codes are base 94 numbers over the printable characters ! to ~
+    string idcode(int n)
+    {
+        string code;
+        do
+        {
+            code += char( '!' + n % 94 );
+            n /= 94;
+        } while ( n );
+        return code;
+    }
+public:
+    string addVar(string name, int width)
+    {
+        replace( name.begin(), name.end(), ' ', '_' );
+        auto id = idcode( _nvars++ );
+        fprintf( _fp, "$var wire %d %s %s $end\n", width, id.c_str(), name.c_str() );
+        return id;
+    }
+    void endHeader()
+    {
+        fprintf( _fp, "$upscope $end\n$enddefinitions $end\n" );
+    }
+    // t in seconds, written only if it moved in terms of the timescale
+    void time(double t)
+    {
+        auto ticks = llround( t * 1e15 );
+        if ( ticks == _lasttime ) return;
+        _lasttime = ticks;
+        fprintf( _fp, "#%lld\n", ticks );
+    }
+    // val is MSB first, made of 0, 1 and x
+    void change(const string& id, const string& val)
+    {
+        if ( val.size() == 1 ) fprintf( _fp, "%s%s\n", val.c_str(), id.c_str() );
+        else fprintf( _fp, "b%s %s\n", val.c_str(), id.c_str() );
+    }
+    VcdWriter(string flnm, string scope = "top") : _fp( fopen( flnm.c_str(), "w" ) )
+    {
+        if ( _fp == NULL )
+        {
+            cout << "VcdWriter: could not open " << flnm << endl;
+            exit(1);
+        }
+        fprintf( _fp, "$version spicetools $end\n$timescale 1fs $end\n$scope module %s $end\n",
+            scope.c_str() );
+    }
+    ~VcdWriter() { fclose(_fp); }
+};
+
+#endif